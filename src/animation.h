@@ -5,11 +5,15 @@
  */
 
 #pragma once
+#include <float.h>
 #include <stdbool.h>
 #include <time.h>
 
 typedef double anim_time_interval_t;
 
+// Deadline used when nothing is scheduled
+#define ANIM_TIME_NEVER DBL_MAX
+
 struct animation_t;
 typedef void(*AnimationCompletion)(struct animation_t *anim, void *context);
 
@@ -42,7 +46,7 @@ typedef struct {
 
 // Spinner shown when checking password
 typedef struct {
-    double rotation;
+    unsigned frame;     // Index into the pre-rotated spinner frames
 } SpinnerAnimation;
 
 typedef union {
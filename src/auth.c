@@ -39,6 +39,10 @@ int process_message(const struct pam_message *msg, struct pam_response *resp, st
             resp->resp = malloc(MAX_RESPONSE_SIZE);
             strncpy(resp->resp, response.response_buffer, MAX_RESPONSE_SIZE);
             resp->resp_retcode = 0; // docs say this should always be zero
+
+            // PAM has its own copy now
+            explicit_bzero(&response, sizeof(response));
+            explicit_bzero(&handle->prompt_response, sizeof(handle->prompt_response));
             break;
         }
         case PAM_ERROR_MSG:
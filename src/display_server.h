@@ -7,7 +7,10 @@
 
 #pragma once
 
+#include "animation.h"
+
 #include <cairo/cairo.h>
+#include <poll.h>
 #include <stdbool.h>
 
 typedef enum {
@@ -18,32 +21,68 @@ typedef enum {
 typedef struct {
     int x;
     int y;
-    int width;
+    int width;      // Logical size, which everything is laid out in
     int height;
+    double scale;   // Device pixels per logical pixel
+
+    // Size of the view's surface (about `scale` times the logical size, give or take rounding)
+    int pixel_width;
+    int pixel_height;
 } display_bounds_t;
 
+// Every output gets locked, but outputs that show identical pixels (same size and
+// scale) are grouped into a single view, which is rendered once and shared.
+#define kMaxViews 8
+
+// A buffer covering part of a view's canvas. Backends that can compose several buffers only
+// hand out planes for where there's content; everything else shows the background color.
+typedef struct {
+    cairo_surface_t        *surface;
+    cairo_rectangle_int_t   rect;       // Where `surface` sits on the canvas, in device pixels
+} display_plane_t;
+
+#define kMaxPlanes 4
+
 // Backend interface
 typedef struct display_server_interface {
     // Initialize the display server connection
     bool (*init)(void);
     
-    // Create and setup the lock screen surface(s)
+    // Create and setup the lock screen surface(s). Returns the first view's surface.
     cairo_surface_t* (*acquire_surface)(void);
+
+    // Upper bound on view indices. Some may be unused (e.g., after an output was unplugged),
+    // in which case they never have a frame available.
+    unsigned int (*get_num_views)(void);
     
-    // Get display bounds for the specified monitor
-    void (*get_display_bounds)(unsigned int monitor_num, display_bounds_t *bounds);
+    // Get the bounds of the canvas for the specified view
+    void (*get_view_bounds)(unsigned int view, display_bounds_t *bounds);
     
     // Poll for events (keyboard, resize, etc.) 
     void (*poll_events)(void *state);
+
+    // Fill `fds` with the file descriptors the runloop should sleep on while idle.
+    // Returns the number of descriptors written (at most `max_fds`).
+    int (*get_poll_fds)(struct pollfd *fds, int max_fds);
     
-    // Commit surface changes 
-    void (*commit_surface)(void);
+    // Fills `planes` with the surfaces to draw the view's next frame into, and returns how many
+    // there are (0 if none are available yet). Their contents are those of the view's previously
+    // committed frame.
+    unsigned int (*begin_frame)(unsigned int view, display_plane_t *planes);
+    
+    // Commit the view's surface changes to all of its outputs. Only the pixels in `damage`
+    // (canvas device pixels) changed since the last commit.
+    void (*commit_surface)(unsigned int view, const cairo_region_t *damage);
+
+    // Color of everything not covered by a plane, from each view's next commit on.
+    void (*set_background_color)(double r, double g, double b);
     
     // Unlock session (must call once auth is complete)
     void (*unlock_session)(void);
 
-    // If applicable, waits for the next frame to be available for commit. 
-    void (*await_frame)(void);
+    // Returns the earliest time the view's next frame should be committed. Used by the
+    // runloop to pace animations without sleeping inside the backend.
+    anim_time_interval_t (*next_frame_time)(unsigned int view);
     
     // Cleanup resources
     void (*destroy_surface)(cairo_surface_t *surface);
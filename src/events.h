@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdlib.h>
 
 typedef enum {
@@ -24,4 +25,7 @@ typedef struct {
 void queue_event(event_t event);
 
 // X11 support functions
-unsigned int get_preferred_monitor_num(void);
\ No newline at end of file
+unsigned int get_preferred_monitor_num(void);
+
+// Whether BUZZLOCKER_MONITOR_NUM restricts the locker to a single monitor
+bool has_preferred_monitor(void);
\ No newline at end of file
@@ -0,0 +1,247 @@
+/*
+ * fill.c
+ *
+ * Solid fills and blends written straight into 32bpp image memory
+ */
+
+#include "fill.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FILL_HAVE_X86_KERNELS 1
+#endif
+
+typedef enum {
+    FILL_KERNEL_SCALAR,
+    FILL_KERNEL_SSE2,
+    FILL_KERNEL_AVX2,
+} fill_kernel_t;
+
+static fill_kernel_t get_kernel(void)
+{
+#ifdef FILL_HAVE_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        return FILL_KERNEL_AVX2;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return FILL_KERNEL_SSE2;
+    }
+#endif
+
+    return FILL_KERNEL_SCALAR;
+}
+
+uint32_t fill_pixel_from_rgba(double r, double g, double b, double a)
+{
+    const double alpha = fmin(fmax(a, 0.0), 1.0);
+    const uint32_t a8 = (uint32_t)lround(alpha * 255.0);
+    const uint32_t r8 = (uint32_t)lround(fmin(fmax(r, 0.0), 1.0) * alpha * 255.0);
+    const uint32_t g8 = (uint32_t)lround(fmin(fmax(g, 0.0), 1.0) * alpha * 255.0);
+    const uint32_t b8 = (uint32_t)lround(fmin(fmax(b, 0.0), 1.0) * alpha * 255.0);
+
+    return (a8 << 24) | (r8 << 16) | (g8 << 8) | b8;
+}
+
+/* Scalar */
+
+static void fill_row_scalar(uint32_t *row, int width, uint32_t pixel)
+{
+    for (int x = 0; x < width; x++) {
+        row[x] = pixel;
+    }
+}
+
+// (x / 255), rounded, for x in [0, 255 * 255]
+static inline uint32_t div_255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t blend_pixel(uint32_t dst, uint32_t src, uint32_t inv_alpha)
+{
+    uint32_t result = 0;
+    for (unsigned shift = 0; shift < 32; shift += 8) {
+        const uint32_t channel = ((src >> shift) & 0xff) + div_255(((dst >> shift) & 0xff) * inv_alpha);
+        result |= (channel > 0xff ? 0xff : channel) << shift;
+    }
+
+    return result;
+}
+
+static void blend_row_scalar(uint32_t *row, int width, uint32_t pixel)
+{
+    const uint32_t inv_alpha = 255 - (pixel >> 24);
+    for (int x = 0; x < width; x++) {
+        row[x] = blend_pixel(row[x], pixel, inv_alpha);
+    }
+}
+
+#ifdef FILL_HAVE_X86_KERNELS
+
+/* SSE2 */
+
+__attribute__((target("sse2")))
+static void fill_row_sse2(uint32_t *row, int width, uint32_t pixel)
+{
+    int x = 0;
+    for (; x < width && ((uintptr_t)(row + x) & 15); x++) {
+        row[x] = pixel;
+    }
+
+    const __m128i value = _mm_set1_epi32(pixel);
+    for (; x + 4 <= width; x += 4) {
+        _mm_store_si128((__m128i *)(row + x), value);
+    }
+
+    for (; x < width; x++) {
+        row[x] = pixel;
+    }
+}
+
+// Two pixels per 16-bit lane set: dst * inv_alpha / 255
+__attribute__((target("sse2")))
+static inline __m128i scale_pixels_sse2(__m128i pixels, __m128i inv_alpha)
+{
+    const __m128i bias = _mm_set1_epi16(128);
+    pixels = _mm_add_epi16(_mm_mullo_epi16(pixels, inv_alpha), bias);
+    return _mm_srli_epi16(_mm_add_epi16(pixels, _mm_srli_epi16(pixels, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void blend_row_sse2(uint32_t *row, int width, uint32_t pixel)
+{
+    const uint32_t inv_alpha_scalar = 255 - (pixel >> 24);
+    const __m128i src = _mm_set1_epi32(pixel);
+    const __m128i inv_alpha = _mm_set1_epi16(inv_alpha_scalar);
+    const __m128i zero = _mm_setzero_si128();
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i dst = _mm_loadu_si128((const __m128i *)(row + x));
+        const __m128i lo = scale_pixels_sse2(_mm_unpacklo_epi8(dst, zero), inv_alpha);
+        const __m128i hi = scale_pixels_sse2(_mm_unpackhi_epi8(dst, zero), inv_alpha);
+        _mm_storeu_si128((__m128i *)(row + x), _mm_adds_epu8(_mm_packus_epi16(lo, hi), src));
+    }
+
+    for (; x < width; x++) {
+        row[x] = blend_pixel(row[x], pixel, inv_alpha_scalar);
+    }
+}
+
+/* AVX2 */
+
+__attribute__((target("avx2")))
+static void fill_row_avx2(uint32_t *row, int width, uint32_t pixel)
+{
+    int x = 0;
+    for (; x < width && ((uintptr_t)(row + x) & 31); x++) {
+        row[x] = pixel;
+    }
+
+    const __m256i value = _mm256_set1_epi32(pixel);
+    for (; x + 8 <= width; x += 8) {
+        _mm256_store_si256((__m256i *)(row + x), value);
+    }
+
+    for (; x < width; x++) {
+        row[x] = pixel;
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i scale_pixels_avx2(__m256i pixels, __m256i inv_alpha)
+{
+    const __m256i bias = _mm256_set1_epi16(128);
+    pixels = _mm256_add_epi16(_mm256_mullo_epi16(pixels, inv_alpha), bias);
+    return _mm256_srli_epi16(_mm256_add_epi16(pixels, _mm256_srli_epi16(pixels, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void blend_row_avx2(uint32_t *row, int width, uint32_t pixel)
+{
+    const uint32_t inv_alpha_scalar = 255 - (pixel >> 24);
+    const __m256i src = _mm256_set1_epi32(pixel);
+    const __m256i inv_alpha = _mm256_set1_epi16(inv_alpha_scalar);
+    const __m256i zero = _mm256_setzero_si256();
+
+    // Unpacking and packing both work within 128-bit lanes, so pixels stay in order
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m256i dst = _mm256_loadu_si256((const __m256i *)(row + x));
+        const __m256i lo = scale_pixels_avx2(_mm256_unpacklo_epi8(dst, zero), inv_alpha);
+        const __m256i hi = scale_pixels_avx2(_mm256_unpackhi_epi8(dst, zero), inv_alpha);
+        _mm256_storeu_si256((__m256i *)(row + x), _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), src));
+    }
+
+    for (; x < width; x++) {
+        row[x] = blend_pixel(row[x], pixel, inv_alpha_scalar);
+    }
+}
+
+#endif // FILL_HAVE_X86_KERNELS
+
+typedef void (*row_func_t)(uint32_t *row, int width, uint32_t pixel);
+
+static void for_each_row(unsigned char *data, int stride, cairo_rectangle_int_t rect, uint32_t pixel, row_func_t func)
+{
+    if (rect.width <= 0 || rect.height <= 0) {
+        return;
+    }
+
+    unsigned char *row = data + ((size_t)rect.y * stride) + ((size_t)rect.x * 4);
+    for (int y = 0; y < rect.height; y++, row += stride) {
+        func((uint32_t *)row, rect.width, pixel);
+    }
+}
+
+void fill_rect_solid(unsigned char *data, int stride, cairo_rectangle_int_t rect, uint32_t pixel)
+{
+    row_func_t func = fill_row_scalar;
+#ifdef FILL_HAVE_X86_KERNELS
+    switch (get_kernel()) {
+        case FILL_KERNEL_AVX2: func = fill_row_avx2; break;
+        case FILL_KERNEL_SSE2: func = fill_row_sse2; break;
+        default: break;
+    }
+#endif
+
+    for_each_row(data, stride, rect, pixel, func);
+}
+
+void fill_rect_blend(unsigned char *data, int stride, cairo_rectangle_int_t rect, uint32_t pixel)
+{
+    if ((pixel >> 24) == 0xff) {
+        // Opaque, nothing shows through
+        fill_rect_solid(data, stride, rect, pixel);
+        return;
+    }
+
+    if (pixel == 0) {
+        return;
+    }
+
+    row_func_t func = blend_row_scalar;
+#ifdef FILL_HAVE_X86_KERNELS
+    switch (get_kernel()) {
+        case FILL_KERNEL_AVX2: func = blend_row_avx2; break;
+        case FILL_KERNEL_SSE2: func = blend_row_sse2; break;
+        default: break;
+    }
+#endif
+
+    for_each_row(data, stride, rect, pixel, func);
+}
+
+const char* fill_get_kernel_name(void)
+{
+    switch (get_kernel()) {
+        case FILL_KERNEL_AVX2: return "avx2";
+        case FILL_KERNEL_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
@@ -0,0 +1,22 @@
+/*
+ * fill.h
+ *
+ * Solid fills and blends written straight into 32bpp image memory
+ */
+
+#pragma once
+
+#include <cairo/cairo.h>
+#include <stdint.h>
+
+// Premultiplied ARGB32, as cairo stores it
+uint32_t fill_pixel_from_rgba(double r, double g, double b, double a);
+
+// Overwrites every pixel in `rect` with `pixel`
+void fill_rect_solid(unsigned char *data, int stride, cairo_rectangle_int_t rect, uint32_t pixel);
+
+// Composites `pixel` over every pixel in `rect` (OVER, premultiplied)
+void fill_rect_blend(unsigned char *data, int stride, cairo_rectangle_int_t rect, uint32_t pixel);
+
+// Which kernels the fills above ended up using on this CPU ("avx2", "sse2" or "scalar")
+const char* fill_get_kernel_name(void);
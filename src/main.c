@@ -6,22 +6,63 @@
 
 #include "auth.h"
 #include "render.h"
+#include "render_pool.h"
+#include "fill.h"
 #include "display_server.h"
 #include "events.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
 static const int kXSecureLockCharFD = 0;
 
+// Backend fds + wakeup fd + timer fd
+#define kMaxPollFDs 8
+
+// Written to by the auth thread to interrupt the runloop while it is sleeping
+static int wakeup_fd = -1;
+
+// Armed for the nearest timer/animation deadline while the runloop is sleeping
+static int timer_fd = -1;
+
+// Result posted by the auth thread, handled on the main thread (timers and
+// animations are only ever touched from the runloop).
+#define kNoAuthResult -1
+static atomic_int pending_auth_result = kNoAuthResult;
+
+// Likewise for the last prompt or message the auth thread wants shown, and whether it's
+// asking for a password (which lets the user type again).
+static pthread_mutex_t pending_prompt_lock = PTHREAD_MUTEX_INITIALIZER;
+static char pending_prompt[kMaxPromptLength];
+static bool has_pending_prompt = false;
+static bool pending_prompt_wants_input = false;
+
 static const char *kDefaultFont = "Input Mono 22";
 static const char *kClockFont = "Sans Italic 20";
 
 static const char *kEnableClockEnvVar = "BUZZLOCKER_ENABLE_CLOCK";
+static const char *kRenderModeEnvVar = "BUZZLOCKER_RENDER_MODE";
+static const char *kFrameStatsEnvVar = "BUZZLOCKER_FRAME_STATS";
+
+static bool frame_stats_enabled = false;
+
+// Each view is drawn on its own thread; the main thread handles events and commits.
+static render_pool_t render_pool;
+
+// Layers each view still has to draw. A view can fall behind the others (e.g., while the
+// display server holds on to all of its buffers) and catches up on its next frame.
+static layer_type_t view_dirty_layers[kMaxViews] = { 0 };
 
 static inline saver_state_t* saver_state(void *c)
 {
@@ -41,12 +82,10 @@ static void ending_animation_completed(struct animation_t *animation, void *cont
 static void authentication_accepted(saver_state_t *state);
 static void authentication_rejected(saver_state_t *state);
 
-static timer_id push_timer(saver_state_t *state, saver_timer_t *timer);
-void reset_timer(saver_state_t *state, timer_id timerid, anim_time_interval_t duration);
-void cancel_timer(saver_state_t *state, timer_id timer);
-
-static void draw(saver_state_t *state);
-static void timers(saver_state_t *state);
+static void commit_view(unsigned view);
+static anim_time_interval_t next_frame_deadline(saver_state_t *state);
+static void wait_for_work(saver_state_t *state);
+static void wake_runloop(void);
 static int runloop(saver_state_t *state);
 
 void callback_show_info(const char *info_msg, void *context);
@@ -106,12 +145,13 @@ void window_changed_size(saver_state_t *state, XConfigureEvent *event)
 void handle_event(saver_state_t *state, event_t event)
 {
     char *password_buf = state->password_buffer;
-    const size_t pw_len = strlen(password_buf);
+    const unsigned pw_len = state->password_length;
 
     switch (event.type) {
         case EVENT_KEYBOARD_BACKSPACE:
             if (state->input_allowed && pw_len > 0) {
                 password_buf[pw_len - 1] = '\0';
+                state->password_length = pw_len - 1;
             }
             break;
         case EVENT_KEYBOARD_RETURN:
@@ -128,10 +168,12 @@ void handle_event(saver_state_t *state, event_t event)
             if (state->input_allowed && pw_len + 1 < kMaxPasswordLength) {
                 password_buf[pw_len] = event.codepoint; // TODO: does not handle unicode correctly. 
                 password_buf[pw_len + 1] = '\0';
+                state->password_length = pw_len + 1;
             }
             break;
         case EVENT_SURFACE_SIZE_CHANGED:
             fprintf(stderr, "Got surface size changed event\n");
+            render_pool_invalidate_resources(&render_pool);
             set_layer_needs_draw(state, ALL_LAYERS, true);
         default:
             break;
@@ -147,7 +189,9 @@ void handle_event(saver_state_t *state, event_t event)
 
 static void clear_password(saver_state_t *state)
 {
-    state->password_buffer[0] = '\0';
+    // All of it, so the typed password doesn't linger in memory
+    explicit_bzero(state->password_buffer, sizeof(state->password_buffer));
+    state->password_length = 0;
 }
 
 static void accept_password(saver_state_t *state)
@@ -156,15 +200,13 @@ static void accept_password(saver_state_t *state)
     strncpy(response.response_buffer, state->password_buffer, MAX_RESPONSE_SIZE);
     response.response_code = 0;
     auth_attempt_authentication(state->auth_handle, response);
+    explicit_bzero(&response, sizeof(response));
 
     // Block input until we hear back from the auth thread
     state->input_allowed = false;
 
     // Schedule a timer to show the "Authenticating..." UI after some time 
-    saver_timer_t timer;
-    timer.exec_time = anim_now() + 0.5;
-    timer.callback = callback_show_auth_progress;
-    state->show_spinner_timer = push_timer(state, &timer);
+    state->show_spinner_timer = timer_schedule(&state->timers, anim_now() + 0.5, callback_show_auth_progress, state);
 }
 
 static void reset_cursor_flash_anim(saver_state_t *state) 
@@ -185,7 +227,7 @@ static void ending_animation_completed(struct animation_t *animation, void *cont
 static void authentication_accepted(saver_state_t *state)
 {
     // Cancel timer to show spinner
-    cancel_timer(state, state->show_spinner_timer);
+    timer_cancel(&state->timers, state->show_spinner_timer);
 
     state->is_processing = false;
     set_password_prompt(state, "Welcome");
@@ -196,6 +238,7 @@ static void authentication_accepted(saver_state_t *state)
     if (cursor_anim) {
         cursor_anim->anim.cursor_anim.cursor_animating = false;
         state->cursor_opacity = 0.0;
+        set_layer_needs_draw(state, LAYER_CURSOR, true);
     }
 
     animation_t out_animation = {
@@ -222,32 +265,73 @@ static void authentication_rejected(saver_state_t *state)
  * Auth callbacks
  */
 
+static void post_prompt(const char *prompt, bool wants_input)
+{
+    pthread_mutex_lock(&pending_prompt_lock);
+    strncpy(pending_prompt, prompt, kMaxPromptLength - 1);
+    pending_prompt[kMaxPromptLength - 1] = '\0';
+    has_pending_prompt = true;
+    pending_prompt_wants_input |= wants_input;
+    pthread_mutex_unlock(&pending_prompt_lock);
+
+    wake_runloop();
+}
+
 void callback_show_info(const char *info_msg, void *context)
 {
-    saver_state_t *state = saver_state(context);
-    set_password_prompt(state, info_msg);
-    set_layer_needs_draw(state, LAYER_PROMPT, true);
+    post_prompt(info_msg, false);
 }
 
 void callback_show_error(const char *error_msg, void *context)
 {
-    saver_state_t *state = saver_state(context);
-    set_password_prompt(state, error_msg);
-    set_layer_needs_draw(state, LAYER_PROMPT, true);
+    post_prompt(error_msg, false);
 }
 
 void callback_prompt_user(const char *prompt, void *context)
 {
-    saver_state_t *state = saver_state(context);
-    set_password_prompt(state, prompt);
-    state->input_allowed = true;
-    state->is_processing = false;
-    set_layer_needs_draw(state, LAYER_PROMPT, true);
+    post_prompt(prompt, true);
 }
 
 void callback_authentication_result(int result, void *context)
 {
-    saver_state_t *state = saver_state(context);
+    atomic_store(&pending_auth_result, result);
+    wake_runloop();
+}
+
+static void handle_auth_prompt(saver_state_t *state)
+{
+    pthread_mutex_lock(&pending_prompt_lock);
+    const bool has_prompt = has_pending_prompt;
+    const bool wants_input = pending_prompt_wants_input;
+    if (has_prompt) {
+        set_password_prompt(state, pending_prompt);
+    }
+    has_pending_prompt = false;
+    pending_prompt_wants_input = false;
+    pthread_mutex_unlock(&pending_prompt_lock);
+
+    if (!has_prompt) {
+        return;
+    }
+
+    if (wants_input) {
+        state->input_allowed = true;
+        state->is_processing = false;
+    }
+
+    set_layer_needs_draw(state, LAYER_PROMPT, true);
+}
+
+static void handle_auth_result(saver_state_t *state)
+{
+    // A new prompt after a failed attempt goes up along with the result
+    handle_auth_prompt(state);
+
+    int result = atomic_exchange(&pending_auth_result, kNoAuthResult);
+    if (result == kNoAuthResult) {
+        return;
+    }
+
     if (result == 0) {
         authentication_accepted(state);
     } else {
@@ -269,100 +353,172 @@ void callback_show_auth_progress(void *context)
         });
     }
 
-    // Update prompt
+    // Update prompt (the cursor also turns into a bar over the asterisks)
     set_password_prompt(state, "Authenticating...");
+    set_layer_needs_draw(state, LAYER_PROMPT | LAYER_CURSOR, true);
 }
 
 void callback_update_clock(void *context)
 {
     saver_state_t *state = saver_state(context);
 
-    time_t n_time = time(NULL);
-    struct tm *now = localtime(&n_time);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    struct tm *now = localtime(&ts.tv_sec);
     snprintf(state->clock_str, kMaxClockLength, "%.2d:%.2d:%.2d", 
         now->tm_hour, now->tm_min, now->tm_sec);
 
-    set_layer_needs_draw(state, LAYER_CLOCK | LAYER_LOGO, true);
-    reset_timer(state, state->clock_update_timer_id, 1.0);
+    // The clock erases its previous time itself, so the sidebar stays as it is
+    set_layer_needs_draw(state, LAYER_CLOCK, true);
+
+    // Fire again right as the next second starts, rather than drifting a second from now
+    const anim_time_interval_t until_next_second = 1.0 - (ts.tv_nsec / 1000000000.0);
+    timer_reschedule(&state->timers, state->clock_update_timer_id, anim_now() + until_next_second);
 }
 
+
 /*
- * Timers
+ * Main drawing/update routines
  */
 
-timer_id push_timer(saver_state_t *state, saver_timer_t *timer)
+static void handle_pending_events(saver_state_t *state)
 {
-    unsigned int slot = 0;
-    for (unsigned int i = 0; i < kMaxTimers; i++) {
-        saver_timer_t *timer_slot = &state->timers[i];
-        if (timer_slot->active == false) {
-            slot = i;
-            timer->active = true;
-            memcpy(timer_slot, timer, sizeof (saver_timer_t));
-            
-            break;
-        }
+    event_t event = { 0 };
+    while (pop_event(&event)) {
+        handle_event(state, event);
     }
-
-    return slot;
 }
 
-void reset_timer(saver_state_t *state, timer_id timerid, anim_time_interval_t duration)
+// Of the surface the frame was drawn into (what the backend gave us)
+static int get_target_bytes_per_pixel(saver_state_t *state)
 {
-    saver_timer_t *timer = &state->timers[timerid];
-    timer->exec_time = anim_now() + duration;
-    timer->active = true;
+    if (state->surface == NULL || cairo_surface_get_type(state->surface) != CAIRO_SURFACE_TYPE_IMAGE) {
+        return 4;
+    }
+
+    switch (cairo_image_surface_get_format(state->surface)) {
+        case CAIRO_FORMAT_RGB16_565: return 2;
+        case CAIRO_FORMAT_A8: return 1;
+        default: return 4;
+    }
 }
 
-void cancel_timer(saver_state_t *state, timer_id timerid)
+static void log_frame_stats(saver_state_t *state, double render_usec)
 {
-    saver_timer_t *timer = &state->timers[timerid];
-    timer->active = false;
-}
+    long long damaged_pixels = 0;
+    const int num_rects = cairo_region_num_rectangles(state->damage);
+    for (int i = 0; i < num_rects; i++) {
+        cairo_rectangle_int_t rect;
+        cairo_region_get_rectangle(state->damage, i, &rect);
+        damaged_pixels += (long long)rect.width * rect.height;
+    }
 
+    // Rough estimate of pixel memory traffic: drawing writes each damaged pixel once. Group
+    // mode draws into a canvas-sized ARGB32 intermediate it clears first, then reads it and
+    // the target and writes the target again while compositing the damaged area.
+    const int target_bpp = get_target_bytes_per_pixel(state);
+    long long bytes = damaged_pixels * target_bpp;
+    if (state->render_mode == RENDER_MODE_GROUP) {
+        bytes = ((long long)state->canvas_pixel_width * state->canvas_pixel_height * 4)
+              + (damaged_pixels * 4) + (damaged_pixels * (4 + (2 * target_bpp)));
+    }
 
-/*
- * Main drawing/update routines
- */
+    fprintf(stderr, "frame: %s, %d damage rects, %lld px, est. %.2f MB, %.0f us\n",
+        (state->render_mode == RENDER_MODE_GROUP) ? "group" : "direct",
+        num_rects, damaged_pixels, bytes / (1024.0 * 1024.0), render_usec);
+}
 
-static void handle_pending_events(saver_state_t *state)
+static void wake_runloop(void)
 {
-    event_t event = { 0 };
-    if (pop_event(&event)) {
-        handle_event(state, event);
+    const uint64_t value = 1;
+    if (write(wakeup_fd, &value, sizeof(value)) < 0) {
+        fprintf(stderr, "Failed to wake runloop: %s\n", strerror(errno));
     }
 }
 
-static void draw(saver_state_t *state)
+static void arm_timer_fd(anim_time_interval_t interval)
 {
-    if (layer_needs_draw(state, LAYER_BACKGROUND)) {
-        draw_background(state, 0, 0, state->canvas_width, state->canvas_height);
+    struct itimerspec spec = { 0 };
+    if (interval != ANIM_TIME_NEVER) {
+        // A zero it_value disarms the timer, so always wait at least 1ns.
+        const long long nsec = MAX(1, (long long)(interval * 1000000000.0));
+        spec.it_value.tv_sec = nsec / 1000000000;
+        spec.it_value.tv_nsec = nsec % 1000000000;
     }
 
-    if (layer_needs_draw(state, LAYER_LOGO)) {
-        draw_logo(state);
+    timerfd_settime(timer_fd, 0, &spec, NULL);
+}
+
+static void wait_for_work(saver_state_t *state)
+{
+    const display_server_interface_t *interface = display_server_get_interface();
+
+    // Pick up anything that arrived while we were drawing (this also flushes our
+    // outgoing requests), so we never go to sleep with work already queued.
+    interface->poll_events(state);
+    if (event_queue.size > 0) {
+        return;
     }
 
-    if (state->clock_enabled && layer_needs_draw(state, LAYER_CLOCK)) {
-        draw_clock(state);
+    anim_time_interval_t deadline = MIN(timer_next_deadline(&state->timers), next_frame_deadline(state));
+
+    const anim_time_interval_t now = anim_now();
+    if (deadline <= now) {
+        return;
     }
 
-    draw_password_field(state);
+    arm_timer_fd((deadline == ANIM_TIME_NEVER) ? ANIM_TIME_NEVER : (deadline - now));
+
+    struct pollfd fds[kMaxPollFDs];
+    int num_fds = interface->get_poll_fds(fds, kMaxPollFDs - 2);
+    fds[num_fds++] = (struct pollfd) { .fd = wakeup_fd, .events = POLLIN };
+    fds[num_fds++] = (struct pollfd) { .fd = timer_fd, .events = POLLIN };
 
-    // Automatically reset this after every draw call
-    set_layer_needs_draw(state, LAYER_BACKGROUND, false);
+    if (poll(fds, num_fds, -1) < 0 && errno != EINTR) {
+        fprintf(stderr, "poll() failed: %s\n", strerror(errno));
+    }
+
+    // Both are non-blocking; reading resets them so they don't stay readable.
+    uint64_t unused_count;
+    while (read(timer_fd, &unused_count, sizeof(unused_count)) > 0);
+    while (read(wakeup_fd, &unused_count, sizeof(unused_count)) > 0);
 }
 
-static void timers(saver_state_t *state)
+static anim_time_interval_t next_frame_deadline(saver_state_t *state)
 {
-    anim_time_interval_t now = anim_now();
-    for (unsigned int i = 0; i < kMaxTimers; i++) {
-        saver_timer_t *timer = &state->timers[i];
-        if (timer->active && now > timer->exec_time) {
-            timer->active = false;
-            timer->callback((struct saver_state_t *)state);
+    // Dirty layers want a frame right away, but still have to wait for the
+    // display server to be ready for one.
+    const display_server_interface_t *interface = display_server_get_interface();
+    const anim_time_interval_t animation_deadline = next_animation_deadline(state);
+
+    anim_time_interval_t deadline = ANIM_TIME_NEVER;
+    for (unsigned view = 0; view < interface->get_num_views(); view++) {
+        const bool view_is_dirty = ((state->dirty_layers | view_dirty_layers[view]) != 0);
+        const anim_time_interval_t changes_at = view_is_dirty ? 0.0 : animation_deadline;
+        if (changes_at != ANIM_TIME_NEVER) {
+            deadline = MIN(deadline, MAX(changes_at, interface->next_frame_time(view)));
         }
     }
+
+    return deadline;
+}
+
+static void commit_view(unsigned view)
+{
+    const display_server_interface_t *interface = display_server_get_interface();
+
+    double render_usec = 0.0;
+    saver_state_t *frame = render_pool_take_frame(&render_pool, view, &render_usec);
+    if (frame == NULL) {
+        return;
+    }
+
+    if (frame_stats_enabled) {
+        log_frame_stats(frame, render_usec);
+    }
+
+    interface->commit_surface(view, frame->damage);
+    clear_damage(frame);
 }
 
 static int runloop(saver_state_t *state)
@@ -370,24 +526,55 @@ static int runloop(saver_state_t *state)
     // Main run loop
     const display_server_interface_t *interface = display_server_get_interface();
     while (!state->is_authenticated) {
-        update_animations(state);
         interface->poll_events(state);
         handle_pending_events(state);
+        handle_auth_result(state);
+        timer_fire_expired(&state->timers, anim_now());
+        update_animations(state);
 
-        cairo_push_group(state->ctx);
-        
-        draw(state);
-        
-        cairo_pop_group_to_source(state->ctx);
+        // Whatever changed has to reach every view, but each view draws it on its own schedule.
+        const layer_type_t changed_layers = state->dirty_layers;
+        const unsigned num_views = interface->get_num_views();
+        for (unsigned view = 0; view < num_views; view++) {
+            view_dirty_layers[view] |= changed_layers;
+        }
 
-        cairo_paint(state->ctx);
-        cairo_surface_flush(state->surface);
+        // Display servers that can show the background without us drawing it get the new color first
+        if (changed_layers & LAYER_BACKGROUND) {
+            double red, green, blue;
+            get_background_color(state, &red, &green, &blue);
+            interface->set_background_color(red, green, blue);
+        }
 
-        interface->commit_surface();
+        // Only produce a frame if something on screen changed (animations mark the
+        // layers they affect as dirty), and the display server is ready to show it.
+        for (unsigned view = 0; view < num_views; view++) {
+            if (view_dirty_layers[view] == 0 || interface->next_frame_time(view) > anim_now()) {
+                continue;
+            }
 
-        timers(state);
+            display_plane_t planes[kMaxPlanes];
+            const unsigned num_planes = interface->begin_frame(view, planes);
+            if (num_planes > 0) {
+                display_bounds_t bounds;
+                interface->get_view_bounds(view, &bounds);
+                render_pool_submit(&render_pool, view, state, planes, num_planes, &bounds, view_dirty_layers[view]);
+                view_dirty_layers[view] = 0;
+            }
+        }
 
-        interface->await_frame();
+        // Views render in parallel, but the display server connection is only ever used from this
+        // thread (views drawn through Xlib were drawn right here, when they were submitted).
+        render_pool_wait(&render_pool);
+        for (unsigned view = 0; view < num_views; view++) {
+            commit_view(view);
+        }
+
+        // Anything marked dirty since (while views were drawing) goes out with the next frame
+        state->dirty_layers &= ~changed_layers;
+
+        // Sleep until there's input, a timer fires, or an animation needs another frame
+        wait_for_work(state);
     }
 
     if (state->is_authenticated) {
@@ -396,11 +583,17 @@ static int runloop(saver_state_t *state)
     }
 
     // Cleanup
-    cairo_destroy(state->ctx);
+    render_pool_destroy(&render_pool);
 
     return EXIT_SUCCESS;
 }
 
+bool has_preferred_monitor(void)
+{
+    const char *preferred_monitor = getenv("BUZZLOCKER_MONITOR_NUM");
+    return (preferred_monitor != NULL && preferred_monitor[0] != 0);
+}
+
 unsigned int get_preferred_monitor_num()
 {
     const char *preferred_monitor = getenv("BUZZLOCKER_MONITOR_NUM");
@@ -462,27 +655,46 @@ int main(int argc, char **argv)
     int flags = fcntl(kXSecureLockCharFD, F_GETFL, 0);
     fcntl(kXSecureLockCharFD, F_SETFL, flags | O_NONBLOCK);
 
-    // Initialize Cairo
-    cairo_t *cr = cairo_create(surface);
+    // Runloop wakeup sources
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (wakeup_fd < 0 || timer_fd < 0) {
+        fprintf(stderr, "Error creating runloop file descriptors\n");
+        exit(1);
+    }
 
-    // Initialize pango context
-    PangoLayout *pango_layout = pango_cairo_create_layout(cr);
+    // Initialize fonts
     PangoFontDescription *status_font = pango_font_description_from_string(kDefaultFont);
     PangoFontDescription *clock_font = pango_font_description_from_string(kClockFont);
 
     saver_state_t state = { 0 };
-    state.ctx = cr;
     state.surface = surface;
     state.cursor_opacity = 1.0;
-    state.pango_layout = pango_layout;
-    state.status_font = status_font;
-    state.clock_font = clock_font;
     state.clock_enabled = enable_clock;
     state.input_allowed = false;
     state.is_authenticated = false;
     state.is_processing = false;
     state.spinner_anim_key = ANIM_KEY_NOEXIST;
 
+    // Workers set up their own sprites and text the first time they draw
+    render_pool_init(&render_pool, status_font, clock_font);
+
+    // Every backend hands out offscreen surfaces that nothing shows until we commit,
+    // so drawing straight into them is safe.
+    state.render_mode = RENDER_MODE_DIRECT;
+
+    const char *render_mode = getenv(kRenderModeEnvVar);
+    if (render_mode != NULL && strcmp(render_mode, "group") == 0) {
+        state.render_mode = RENDER_MODE_GROUP;
+    } else if (render_mode != NULL && strcmp(render_mode, "direct") == 0) {
+        state.render_mode = RENDER_MODE_DIRECT;
+    }
+
+    frame_stats_enabled = getenv(kFrameStatsEnvVar) != NULL;
+    if (frame_stats_enabled) {
+        fprintf(stderr, "Using %s fill kernels\n", fill_get_kernel_name());
+    }
+
     // Add initial animations
     // Cursor animation -- repeats indefinitely
     animation_t cursor_animation = {
@@ -503,22 +715,17 @@ int main(int argc, char **argv)
 
     // Clock update timer
     if (enable_clock) {
-        saver_timer_t clock_update_timer;
-        clock_update_timer.exec_time = anim_now() + 1.0;
-        clock_update_timer.callback = callback_update_clock;
-        state.clock_update_timer_id = push_timer(&state, &clock_update_timer);
+        state.clock_update_timer_id = timer_schedule(&state.timers, anim_now() + 1.0, callback_update_clock, &state);
         callback_update_clock(&state);
     }
 
     display_bounds_t bounds;
-    interface->get_display_bounds(get_preferred_monitor_num(), &bounds);
+    interface->get_view_bounds(0, &bounds);
     state.canvas_width = bounds.width;
     state.canvas_height = bounds.height;
-
-    // Docs say this must be called whenever the size of the window changes (X11 only)
-    if (display_server_get_type() == DISPLAY_SERVER_X11) {
-        cairo_xlib_surface_set_size(surface, state.canvas_width, state.canvas_height);
-    }
+    state.canvas_scale = bounds.scale;
+    state.canvas_pixel_width = bounds.pixel_width;
+    state.canvas_pixel_height = bounds.pixel_height;
 
     auth_callbacks_t callbacks = {
         .info_handler = callback_show_info,
@@ -531,8 +738,12 @@ int main(int argc, char **argv)
 
     int result = runloop(&state);
 
-    interface->destroy_surface(surface);
+    interface->destroy_surface(state.surface);
     interface->cleanup();
+
+    close(timer_fd);
+    close(wakeup_fd);
+
     return result;
 }
 
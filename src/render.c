@@ -5,32 +5,68 @@
  */
 
 #include "render.h"
-#include "resources.h"
+#include "fill.h"
 
 #include <assert.h>
-#include <gio/gio.h>
 #include <math.h>
 
 static const double kLogoBackgroundWidth = 500.0;
 
-GBytes* get_data_for_resource(const char *resource_path)
+// Everything in the password field (prompt, spinner, asterisks and cursor) fits within
+// this far above or below the middle of the canvas.
+static const double kFieldBandHalfHeight = 120.0;
+static const double kCursorFadeDuration = 0.5;
+static const double kSpinnerRevolutionDuration = 1.5;
+static const unsigned kSpinnerFrames = 64;
+
+static bool sidebar_is_opaque(saver_state_t *state)
+{
+    // Once the bar has been wiped in all the way, nothing underneath it shows through
+    return (state->logo_fill_width >= 1.0 && state->logo_fill_height >= 1.0);
+}
+
+void init_render_resources(render_resources_t *resources, cairo_t *cr,
+                           const PangoFontDescription *status_font, const PangoFontDescription *clock_font)
+{
+    sprite_init(&resources->logo_sprite, "/resources/logo.svg");
+    sprite_init(&resources->asterisk_sprite, "/resources/asterisk.svg");
+    sprite_init(&resources->spinner_sprite, "/resources/spinner.svg");
+    sprite_atlas_init(&resources->spinner_atlas, &resources->spinner_sprite, kSpinnerFrames);
+
+    // Each string gets its own layout, so switching between fonts doesn't throw away shaping results
+    text_init(&resources->prompt_text, cr, status_font, (text_color_t) { 1.0, 1.0, 1.0, 1.0 });
+    glyph_atlas_init(&resources->clock_glyphs, cr, clock_font, (text_color_t) { 0.0, 0.0, 0.0, 0.5 }, "0123456789:");
+}
+
+void invalidate_render_resources(render_resources_t *resources)
 {
-    GBytes *result = NULL;
-    GError *error = NULL;
+    sprite_invalidate(&resources->logo_sprite);
+    sprite_invalidate(&resources->asterisk_sprite);
+    sprite_invalidate(&resources->spinner_sprite);
+    sprite_atlas_invalidate(&resources->spinner_atlas);
 
-    GResource *resource = as_get_resource();
-    result = g_resource_lookup_data(
-        resource,
-        resource_path,
-        G_RESOURCE_LOOKUP_FLAGS_NONE,
-        &error
-    );
+    text_invalidate(&resources->prompt_text);
+    glyph_atlas_invalidate(&resources->clock_glyphs);
 
-    if (error != NULL) {
-        fprintf(stderr, "Error loading resource %s\n", resource_path);
+    if (resources->sidebar_surface != NULL) {
+        cairo_surface_destroy(resources->sidebar_surface);
+        resources->sidebar_surface = NULL;
     }
 
-    return result;
+    resources->layout.valid = false;
+    resources->drawn = (drawn_record_t) { 0 };
+}
+
+void destroy_render_resources(render_resources_t *resources)
+{
+    invalidate_render_resources(resources);
+
+    sprite_destroy(&resources->logo_sprite);
+    sprite_destroy(&resources->asterisk_sprite);
+    sprite_destroy(&resources->spinner_sprite);
+
+    text_destroy(&resources->prompt_text);
+    glyph_atlas_destroy(&resources->clock_glyphs);
 }
 
 void set_password_prompt(saver_state_t *state, const char *prompt)
@@ -44,11 +80,11 @@ static void update_single_animation(saver_state_t *state, animation_t *anim)
     // Cursor animation
     if (anim->type == ACursorAnimation) {
         CursorAnimation *ca = &anim->anim.cursor_anim;
+        const double last_opacity = state->cursor_opacity;
 
         if (ca->cursor_animating) {
             if (!state->is_processing) {
-                const double fade_duration = 0.5;
-                const double progress = anim_progress_ease(anim, fade_duration, anim_qubic_ease_out);
+                const double progress = anim_progress_ease(anim, kCursorFadeDuration, anim_qubic_ease_out);
 
                 if (anim->direction == OUT) {
                     state->cursor_opacity = progress;
@@ -64,6 +100,10 @@ static void update_single_animation(saver_state_t *state, animation_t *anim)
                 state->cursor_opacity = 1.0;
             }
         }
+
+        if (state->cursor_opacity != last_opacity) {
+            set_layer_needs_draw(state, LAYER_CURSOR, true);
+        }
     }
 
     // Logo animation
@@ -79,15 +119,12 @@ static void update_single_animation(saver_state_t *state, animation_t *anim)
             state->logo_fill_height = 1.0;
         }
 
+        // Only the strip the wipe moved over gets painted (and the clock, if it's in it)
         state->password_opacity = progress;
-        set_layer_needs_draw(state, LAYER_LOGO | LAYER_CLOCK, true);
-        if (anim->direction == OUT) {
-            // When transitioning OUT, background essentially draws over the logo as it wipes out
-            set_layer_needs_draw(state, LAYER_BACKGROUND, true);
-        }
+        set_layer_needs_draw(state, LAYER_LOGO, true);
 
-        // And since the status text fades along with the logo
-        set_layer_needs_draw(state, LAYER_PROMPT, true);
+        // And since the status text and password field fade along with the logo
+        set_layer_needs_draw(state, LAYER_PROMPT | LAYER_PASSWORD | LAYER_CURSOR, true);
 
         anim->completed = anim_complete(anim, progress);
     }
@@ -115,7 +152,15 @@ static void update_single_animation(saver_state_t *state, animation_t *anim)
 
     // Spinner animation
     else if (anim->type == ASpinnerAnimation) {
-        anim->anim.spinner_anim.rotation += 0.07;
+        // Derived from the time elapsed (not the number of frames drawn), so the
+        // spinner turns at the same speed no matter the refresh rate.
+        SpinnerAnimation *sa = &anim->anim.spinner_anim;
+        const double revolutions = (anim_now() - anim->start_time) / kSpinnerRevolutionDuration;
+        const unsigned frame = (unsigned)(revolutions * kSpinnerFrames) % kSpinnerFrames;
+        if (state->is_processing && frame != sa->frame) {
+            sa->frame = frame;
+            set_layer_needs_draw(state, LAYER_SPINNER, true);
+        }
     }
 }
 
@@ -190,15 +235,70 @@ void update_animations(saver_state_t *state)
     state->num_animations -= completed_animations;
 }
 
+static anim_time_interval_t single_animation_deadline(saver_state_t *state, animation_t *anim, anim_time_interval_t now)
+{
+    if (anim->type == ACursorAnimation) {
+        CursorAnimation *ca = &anim->anim.cursor_anim;
+        if (!ca->cursor_animating || state->is_processing) {
+            // Opacity is held constant
+            return ANIM_TIME_NEVER;
+        }
+
+        if (now < anim->start_time) {
+            // Fade hasn't started yet (see reset_cursor_flash_anim)
+            return anim->start_time;
+        }
+
+        if (anim->direction == IN) {
+            // Cursor is held solid until the next fade
+            return anim->start_time + kCursorFadeDuration;
+        }
+
+        return now;
+    }
+
+    if (anim->type == ASpinnerAnimation) {
+        if (!state->is_processing) {
+            // Not shown
+            return ANIM_TIME_NEVER;
+        }
+
+        // Nothing changes until it's time for the next pre-rotated frame
+        const double frame_duration = kSpinnerRevolutionDuration / kSpinnerFrames;
+        const double elapsed_frames = floor((now - anim->start_time) / frame_duration);
+        return anim->start_time + ((elapsed_frames + 1.0) * frame_duration);
+    }
+
+    // Everything else changes every frame while it is running
+    return now;
+}
+
+anim_time_interval_t next_animation_deadline(saver_state_t *state)
+{
+    const anim_time_interval_t now = anim_now();
+    anim_time_interval_t deadline = ANIM_TIME_NEVER;
+    for (unsigned idx = 0; idx < kMaxAnimations; idx++) {
+        animation_t *anim = &state->animations[idx];
+        if (anim->type == _EmptyAnimationType) continue;
+
+        deadline = MIN(deadline, single_animation_deadline(state, anim, now));
+    }
+
+    return deadline;
+}
+
 bool layer_needs_draw(saver_state_t *state, const layer_type_t type)
 {
-    if (state->dirty_layers & LAYER_BACKGROUND) {
+    layer_type_t dirty_layers = state->dirty_layers;
+    if (dirty_layers & LAYER_BACKGROUND) {
         // Special case: if the background needs to be drawn, everything on top of it
-        // needs to as well.
-        return true;
+        // needs to as well. Except for the sidebar (and the clock on it), once it's
+        // opaque, since the background isn't drawn underneath it then.
+        const layer_type_t sidebar_layers = (LAYER_LOGO | LAYER_CLOCK);
+        dirty_layers |= sidebar_is_opaque(state) ? (ALL_LAYERS & ~sidebar_layers) : ALL_LAYERS;
     }
 
-    return (state->dirty_layers & type);
+    return (dirty_layers & type);
 }
 
 void set_layer_needs_draw(saver_state_t *state, const layer_type_t type, bool needs_draw)
@@ -210,216 +310,587 @@ void set_layer_needs_draw(saver_state_t *state, const layer_type_t type, bool ne
     }
 }
 
-RsvgHandle* load_svg_for_resource_path(const char *resource_path)
+void add_damage(saver_state_t *state, double x, double y, double width, double height)
 {
-    GError *error = NULL;
-    GBytes *bytes = get_data_for_resource(resource_path);
-    RsvgHandle *handle = NULL;
+    // Round outwards (in device pixels) so antialiased edges are included
+    const double scale = state->canvas_scale;
+    const int x1 = floor(x * scale);
+    const int y1 = floor(y * scale);
+    const int x2 = ceil((x + width) * scale);
+    const int y2 = ceil((y + height) * scale);
+    if (x2 <= x1 || y2 <= y1) {
+        return;
+    }
+
+    cairo_rectangle_int_t rect = { x1, y1, x2 - x1, y2 - y1 };
+    cairo_region_t *region = cairo_region_create_rectangle(&rect);
+
+    cairo_rectangle_int_t canvas = { 0, 0, state->canvas_pixel_width, state->canvas_pixel_height };
+    cairo_region_intersect_rectangle(region, &canvas);
+    cairo_region_union(state->damage, region);
+    cairo_region_destroy(region);
+}
 
-    gsize size = 0;
-    gconstpointer data = g_bytes_get_data(bytes, &size);
-    handle = rsvg_handle_new_from_data(data, size, &error);
-    g_bytes_unref(bytes);
-    if (error != NULL) {
-        fprintf(stderr, "Error loading SVG at resource path: %s\n", resource_path);
+void clear_damage(saver_state_t *state)
+{
+    cairo_region_destroy(state->damage);
+    state->damage = cairo_region_create();
+}
+
+// Fills a rect of the canvas with a solid color by writing the target's pixels directly, which
+// is much cheaper than going through cairo for large areas. Edges are snapped to the nearest
+// device pixel. Returns false if the target isn't an image we can write to (cairo has to do it).
+static bool fill_target_rect(saver_state_t *state, double x, double y, double width, double height,
+                             double r, double g, double b, double a)
+{
+    // When composing in a group, drawing doesn't go to the target
+    cairo_surface_t *target = state->surface;
+    if (state->render_mode != RENDER_MODE_DIRECT || cairo_surface_get_type(target) != CAIRO_SURFACE_TYPE_IMAGE) {
+        return false;
+    }
+
+    const cairo_format_t format = cairo_image_surface_get_format(target);
+    if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24) {
+        return false;
+    }
+
+    // The target covers the canvas from (target_x, target_y) on
+    const double scale = state->canvas_scale;
+    const int surface_width = cairo_image_surface_get_width(target);
+    const int surface_height = cairo_image_surface_get_height(target);
+    const int x1 = MAX(0, (int)lround(x * scale) - state->target_x);
+    const int y1 = MAX(0, (int)lround(y * scale) - state->target_y);
+    const int x2 = MIN(surface_width, (int)lround((x + width) * scale) - state->target_x);
+    const int y2 = MIN(surface_height, (int)lround((y + height) * scale) - state->target_y);
+    if (x2 <= x1 || y2 <= y1) {
+        return true;
+    }
+
+    const cairo_rectangle_int_t rect = { x1, y1, x2 - x1, y2 - y1 };
+    const uint32_t pixel = fill_pixel_from_rgba(r, g, b, a);
+
+    cairo_surface_flush(target);
+    unsigned char *data = cairo_image_surface_get_data(target);
+    const int stride = cairo_image_surface_get_stride(target);
+    if (a >= 1.0) {
+        fill_rect_solid(data, stride, rect, pixel);
+    } else {
+        fill_rect_blend(data, stride, rect, pixel);
+    }
+    cairo_surface_mark_dirty_rectangle(target, rect.x, rect.y, rect.width, rect.height);
+
+    return true;
+}
+
+void get_background_color(saver_state_t *state, double *r, double *g, double *b)
+{
+    *r = (state->background_redshift / 1.5);
+    *g = 0.0;
+    *b = 0.0;
+}
+
+unsigned int get_content_rects(int canvas_width, int canvas_height, cairo_rectangle_int_t *rects, unsigned int max_rects)
+{
+    unsigned int num_rects = 0;
+    const int sidebar_width = MIN(canvas_width, (int)kLogoBackgroundWidth);
+    if (num_rects < max_rects && sidebar_width > 0) {
+        rects[num_rects++] = (cairo_rectangle_int_t) { 0, 0, sidebar_width, canvas_height };
+    }
+
+    // The spinner's frames poke out a little to the left of the field, so start right at the sidebar
+    const int field_top = MAX(0, (int)floor((canvas_height / 2.0) - kFieldBandHalfHeight));
+    const int field_bottom = MIN(canvas_height, (int)ceil((canvas_height / 2.0) + kFieldBandHalfHeight));
+    if (num_rects < max_rects && canvas_width > sidebar_width && field_bottom > field_top) {
+        rects[num_rects++] = (cairo_rectangle_int_t) { sidebar_width, field_top, canvas_width - sidebar_width, field_bottom - field_top };
     }
 
-    return handle;
+    return num_rects;
 }
 
 void draw_background(saver_state_t *state, double x, double y, double width, double height)
 {
     // Draw background
-    cairo_t *cr = state->ctx;
-    cairo_save(cr);
-    cairo_set_source_rgba(cr, (state->background_redshift / 1.5), 0.0, 0.0, 1.0);
-    cairo_rectangle(cr, x, y, width, height);
-    cairo_fill(cr);
-    cairo_restore(cr);
+    double red, green, blue;
+    get_background_color(state, &red, &green, &blue);
+    if (!fill_target_rect(state, x, y, width, height, red, green, blue, 1.0)) {
+        cairo_t *cr = state->ctx;
+        cairo_save(cr);
+        cairo_set_source_rgba(cr, red, green, blue, 1.0);
+        cairo_rectangle(cr, x, y, width, height);
+        cairo_fill(cr);
+        cairo_restore(cr);
+    }
+
+    add_damage(state, x, y, width, height);
 }
 
-void draw_logo(saver_state_t *state)
+static void compute_layout(saver_state_t *state, render_layout_t *layout)
 {
-    if (state->logo_svg_handle == NULL) {
-        state->logo_svg_handle = load_svg_for_resource_path("/resources/logo.svg");
+    render_resources_t *resources = state->resources;
+    const double canvas_height = state->canvas_height;
+
+    // Logo, centered in the sidebar
+    const RsvgDimensionData logo_dimensions = sprite_get_dimensions(&resources->logo_sprite);
+    const double logo_padding = 100.0;
+    const double logo_scale_factor = ((kLogoBackgroundWidth - (logo_padding * 2.0)) / logo_dimensions.width);
+    const double logo_width = (logo_dimensions.width * logo_scale_factor);
+    const double logo_height = (logo_dimensions.height * logo_scale_factor);
+    layout->logo_rect = (cairo_rectangle_t) { logo_padding, round((canvas_height - logo_height) / 2.0), logo_width, logo_height };
+
+    // Clock, above the logo (centered horizontally per string, since its width varies)
+    layout->clock_y = 150.0;
+
+    // Password field
+    layout->cursor_height = 40.0;
+    layout->cursor_width = 30.0;
+    layout->field_x = kLogoBackgroundWidth + 50.0;
+    layout->field_y = (canvas_height - layout->cursor_height) / 2.0;
+    layout->field_padding = 10.0;
+
+    const double line_height = layout->prompt_height;
+    layout->prompt_rect = (cairo_rectangle_t) {
+        layout->field_x, layout->field_y - line_height - layout->field_padding,
+        state->canvas_width - layout->field_x, line_height,
+    };
+
+    // Processing indicator
+    const RsvgDimensionData spinner_dimensions = sprite_get_dimensions(&resources->spinner_sprite);
+    const double spinner_scale_factor = ((line_height - 5.0) / spinner_dimensions.height);
+    layout->spinner_width = spinner_dimensions.width * spinner_scale_factor;
+    layout->spinner_height = spinner_dimensions.height * spinner_scale_factor;
+    layout->spinner_center_x = layout->field_x + (layout->spinner_width / 2.0);
+    layout->spinner_center_y = layout->field_y - line_height - 8.0 + (layout->spinner_height / 2.0);
+    layout->prompt_spinner_offset = layout->spinner_width + 10.0;
+
+    // Frames are snapped to the pixel grid, so leave a pixel of slack around them
+    layout->spinner_extent = sprite_atlas_get_frame_extent(layout->spinner_width, layout->spinner_height) + 2.0;
+
+    // Asterisks
+    const RsvgDimensionData asterisk_dimensions = sprite_get_dimensions(&resources->asterisk_sprite);
+    const double cursor_padding_x = 10.0;
+    layout->asterisk_height = layout->cursor_height - 20.0;
+    layout->asterisk_width = asterisk_dimensions.width * (layout->asterisk_height / asterisk_dimensions.height);
+    layout->asterisk_advance = layout->asterisk_width + cursor_padding_x;
+    layout->asterisk_y = layout->field_y + ((layout->cursor_height - layout->asterisk_height) / 2.0);
+}
+
+static const render_layout_t* get_layout(saver_state_t *state)
+{
+    render_resources_t *resources = state->resources;
+    render_layout_t *layout = &resources->layout;
+
+    // Only reshaped when the prompt changed
+    text_set_string(&resources->prompt_text, state->password_prompt);
+    const int prompt_height = resources->prompt_text.logical_rect.height;
+
+    const bool layout_valid = layout->valid && layout->canvas_width == state->canvas_width
+                           && layout->canvas_height == state->canvas_height
+                           && layout->canvas_scale == state->canvas_scale
+                           && layout->prompt_height == prompt_height;
+    if (!layout_valid) {
+        *layout = (render_layout_t) {
+            .valid = true,
+            .canvas_width = state->canvas_width,
+            .canvas_height = state->canvas_height,
+            .canvas_scale = state->canvas_scale,
+            .prompt_height = prompt_height,
+        };
+
+        compute_layout(state, layout);
     }
 
-    cairo_t *cr = state->ctx;
+    return layout;
+}
 
-    // Draw bar background
+static void paint_logo(saver_state_t *state, cairo_t *cr)
+{
+    const cairo_rectangle_t logo_rect = get_layout(state)->logo_rect;
+    sprite_paint(&state->resources->logo_sprite, cr, logo_rect.x, logo_rect.y, logo_rect.width, logo_rect.height, 1.0);
+}
+
+// The purple bar (filled in as far as `fill_width` x `fill_height`) and the logo on top of it
+static void paint_sidebar(saver_state_t *state, cairo_t *cr, double fill_width, double fill_height)
+{
     cairo_save(cr);
     cairo_set_source_rgb(cr, (208.0 / 255.0), (69.0 / 255.0), (255.0 / 255.0));
-    double fill_height = (state->canvas_height * state->logo_fill_height);
-    double fill_width = (kLogoBackgroundWidth * state->logo_fill_width);
     cairo_rectangle(cr, 0, 0, fill_width, fill_height);
     cairo_fill(cr);
 
-    // Common color -- transparent for logo
-    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-    
-    // Scale and draw logo
-    RsvgDimensionData dimensions;
-    rsvg_handle_get_dimensions(state->logo_svg_handle, &dimensions);
-
-    const double padding = 100.0;
-    double scale_factor = ((kLogoBackgroundWidth - (padding * 2.0)) / dimensions.width);
-    double scaled_height = (dimensions.height * scale_factor);
-    double y_position = (state->canvas_height - scaled_height) / 2.0;
-    cairo_translate(cr, padding, y_position);
-    cairo_scale(cr, scale_factor, scale_factor);
-    rsvg_handle_render_cairo(state->logo_svg_handle, cr);
-
+    paint_logo(state, cr);
     cairo_restore(cr);
-
-    set_layer_needs_draw(state, LAYER_LOGO, false);
 }
 
-void draw_clock(saver_state_t *state) 
+// The fully drawn-in sidebar, retained so that whatever sits on top of it (the clock) can be
+// erased without drawing the sidebar again. Rendered again only if the canvas changes size.
+static cairo_surface_t* get_sidebar_surface(saver_state_t *state)
 {
-    cairo_t *cr = state->ctx;
+    render_resources_t *resources = state->resources;
+    const int pixel_width = (int)ceil(kLogoBackgroundWidth * state->canvas_scale);
+    const int pixel_height = state->canvas_pixel_height;
+    if (resources->sidebar_surface != NULL && resources->sidebar_pixel_width == pixel_width
+        && resources->sidebar_pixel_height == pixel_height) {
+        return resources->sidebar_surface;
+    }
+
+    if (resources->sidebar_surface != NULL) {
+        cairo_surface_destroy(resources->sidebar_surface);
+        resources->sidebar_surface = NULL;
+    }
 
-    pango_layout_set_text(state->pango_layout, state->clock_str, -1);
-    pango_layout_set_font_description(state->pango_layout, state->clock_font);
+    cairo_surface_t *surface = cairo_surface_create_similar(state->surface, CAIRO_CONTENT_COLOR, pixel_width, pixel_height);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        return NULL;
+    }
+
+    cairo_t *cr = cairo_create(surface);
+    cairo_scale(cr, state->canvas_scale, state->canvas_scale);
+    paint_sidebar(state, cr, kLogoBackgroundWidth, state->canvas_height);
+    cairo_destroy(cr);
 
-    int width, height;
-    pango_layout_get_pixel_size(state->pango_layout, &width, &height);
+    resources->sidebar_surface = surface;
+    resources->sidebar_pixel_width = pixel_width;
+    resources->sidebar_pixel_height = pixel_height;
+
+    return surface;
+}
+
+// Copies the retained sidebar back over a rect of it (in canvas units). Returns false if there's no
+// retained sidebar to copy from.
+static bool restore_sidebar(saver_state_t *state, double x, double y, double width, double height)
+{
+    cairo_surface_t *sidebar = get_sidebar_surface(state);
+    if (sidebar == NULL) {
+        return false;
+    }
 
+    // Whole device pixels, so the edges don't blend with what was there before. Undoing
+    // the scale leaves `ctx` in canvas device pixels.
+    const double scale = state->canvas_scale;
+    const double x1 = floor(x * scale);
+    const double y1 = floor(y * scale);
+    const double x2 = ceil((x + width) * scale);
+    const double y2 = ceil((y + height) * scale);
+
+    cairo_t *cr = state->ctx;
     cairo_save(cr);
-    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.5);
-    cairo_move_to(cr, 
-        /* x: */ (kLogoBackgroundWidth - width) / 2,
-        /* y: */ 150
-    );
-    pango_cairo_show_layout(cr, state->pango_layout);
+    cairo_scale(cr, 1.0 / scale, 1.0 / scale);
+    cairo_rectangle(cr, x1, y1, x2 - x1, y2 - y1);
+    cairo_clip(cr);
+    cairo_set_source_surface(cr, sidebar, 0, 0);
+    cairo_paint(cr);
     cairo_restore(cr);
 
-    set_layer_needs_draw(state, LAYER_CLOCK, false);
+    add_damage(state, x, y, width, height);
+
+    return true;
 }
 
-void draw_password_field(saver_state_t *state)
+// Grows a rect (canvas units) out to whole device pixels
+static cairo_rectangle_t snap_to_pixels(saver_state_t *state, cairo_rectangle_t rect)
 {
-    const double cursor_height = 40.0;
-    const double cursor_width  = 30.0;
-    const double field_x = kLogoBackgroundWidth + 50.0;
-    const double field_y = (state->canvas_height - cursor_height) / 2.0;
-    const double field_padding = 10.0;
-    
+    const double scale = state->canvas_scale;
+    const double x1 = floor(rect.x * scale) / scale;
+    const double y1 = floor(rect.y * scale) / scale;
+    const double x2 = ceil((rect.x + rect.width) * scale) / scale;
+    const double y2 = ceil((rect.y + rect.height) * scale) / scale;
+
+    return (cairo_rectangle_t) { x1, y1, x2 - x1, y2 - y1 };
+}
+
+// Paints a rect of the sidebar (canvas units) the way it looks at the current fill, minus the
+// clock: the retained sidebar wherever it's filled in, and the background with the logo on
+// it everywhere else.
+static void repaint_sidebar(saver_state_t *state, double x, double y, double width, double height)
+{
+    // Whole device pixels, so the edges don't blend with what was there before
+    const cairo_rectangle_t snapped = snap_to_pixels(state, (cairo_rectangle_t) { x, y, width, height });
+    const double x1 = MAX(0.0, snapped.x);
+    const double y1 = MAX(0.0, snapped.y);
+    const double x2 = MIN(kLogoBackgroundWidth, snapped.x + snapped.width);
+    const double y2 = MIN(state->canvas_height, snapped.y + snapped.height);
+    if (x2 <= x1 || y2 <= y1) {
+        return;
+    }
+
+    const double fill_width = (kLogoBackgroundWidth * state->logo_fill_width);
+    const double fill_height = (state->canvas_height * state->logo_fill_height);
+    const double filled_x2 = MIN(x2, fill_width);
+    const double filled_y2 = MIN(y2, fill_height);
+
     cairo_t *cr = state->ctx;
+    if (x2 > fill_width || y2 > fill_height) {
+        draw_background(state, x1, y1, x2 - x1, y2 - y1);
 
-    // Common color for status and password field
-    cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, state->password_opacity);
+        cairo_save(cr);
+        cairo_rectangle(cr, x1, y1, x2 - x1, y2 - y1);
+        cairo_clip(cr);
+        paint_logo(state, cr);
+        cairo_restore(cr);
+    }
 
-    // Measure status text
-    const char *prompt = state->password_prompt;
-    pango_layout_set_font_description(state->pango_layout, state->status_font);
-    pango_layout_set_text(state->pango_layout, prompt, -1);
+    if (filled_x2 > x1 && filled_y2 > y1 && !restore_sidebar(state, x1, y1, filled_x2 - x1, filled_y2 - y1)) {
+        cairo_save(cr);
+        cairo_rectangle(cr, x1, y1, filled_x2 - x1, filled_y2 - y1);
+        cairo_clip(cr);
+        paint_sidebar(state, cr, fill_width, fill_height);
+        cairo_restore(cr);
+    }
 
-    int t_width, t_height;
-    pango_layout_get_size(state->pango_layout, &t_width, &t_height);
-    double line_height = t_height / PANGO_SCALE;
+    add_damage(state, x1, y1, x2 - x1, y2 - y1);
+}
+
+static bool rects_intersect(const cairo_rectangle_t *a, const cairo_rectangle_t *b)
+{
+    return (a->width > 0.0 && a->height > 0.0 && b->width > 0.0 && b->height > 0.0
+            && a->x < b->x + b->width && b->x < a->x + a->width && a->y < b->y + b->height && b->y < a->y + a->height);
+}
+
+void prepare_render_resources(saver_state_t *state)
+{
+    render_resources_t *resources = state->resources;
+    cairo_t *cr = state->ctx;
+    const render_layout_t *layout = get_layout(state);
 
-    // Measure processing indicator
-    double spinner_width = 0.0;
-    double spinner_scale_factor = 0.0;
-    RsvgDimensionData spinner_dimensions;
+    sprite_prepare(&resources->logo_sprite, cr, layout->logo_rect.width, layout->logo_rect.height);
+    sprite_prepare(&resources->asterisk_sprite, cr, layout->asterisk_width, layout->asterisk_height);
     if (state->is_processing) {
-        if (state->spinner_svg_handle == NULL) {
-            state->spinner_svg_handle = load_svg_for_resource_path("/resources/spinner.svg");
-        }
+        sprite_atlas_prepare(&resources->spinner_atlas, cr, layout->spinner_width, layout->spinner_height);
+    }
 
-        rsvg_handle_get_dimensions(state->spinner_svg_handle, &spinner_dimensions);
-        spinner_scale_factor = ((line_height - 5.0) / spinner_dimensions.height);
-        spinner_width = spinner_dimensions.width * spinner_scale_factor;
+    text_prepare(&resources->prompt_text, cr);
+    if (state->clock_enabled) {
+        glyph_atlas_prepare(&resources->clock_glyphs, cr);
+    }
 
-        // padding
-        spinner_width += 10.0;
+    // Only needed once some of the sidebar is filled in
+    if (state->logo_fill_width > 0.0 && state->logo_fill_height > 0.0) {
+        get_sidebar_surface(state);
     }
+}
 
-    // Draw status text
-    if (layer_needs_draw(state, LAYER_PROMPT) || state->is_processing) {
-        const double y_position = field_y - line_height - field_padding;
-        draw_background(state, field_x, y_position, state->canvas_width - field_x, line_height);
-        cairo_move_to(cr, spinner_width + field_x, y_position);
-        pango_cairo_show_layout(cr, state->pango_layout);
+void draw_full_background(saver_state_t *state)
+{
+    // The logo layer always paints the sidebar's part of the background (whenever this
+    // goes through it, that is), so leave that alone.
+    const double x = MIN(kLogoBackgroundWidth, state->canvas_width);
+    draw_background(state, x, 0, state->canvas_width - x, state->canvas_height);
+}
 
-        set_layer_needs_draw(state, LAYER_PROMPT, false);
+void draw_logo(saver_state_t *state)
+{
+    drawn_record_t *drawn = &state->resources->drawn;
+    const double fill_width = (kLogoBackgroundWidth * state->logo_fill_width);
+    const double fill_height = (state->canvas_height * state->logo_fill_height);
+
+    // Where it's not filled in yet, the sidebar shows the background
+    const bool background_changed = (state->dirty_layers & LAYER_BACKGROUND) && !sidebar_is_opaque(state);
+    if (!drawn->sidebar_valid || background_changed) {
+        // Took the clock with it
+        repaint_sidebar(state, 0, 0, kLogoBackgroundWidth, state->canvas_height);
+        drawn->clock_str[0] = '\0';
+        drawn->clock_rect = (cairo_rectangle_t) { 0 };
+        set_layer_needs_draw(state, LAYER_CLOCK, true);
+    } else {
+        // Only the strips between the old and the new fill changed. Wipes go either across or
+        // down, so usually only one of these isn't empty.
+        const double min_width = MIN(drawn->sidebar_fill_width, fill_width);
+        const double max_width = MAX(drawn->sidebar_fill_width, fill_width);
+        const double min_height = MIN(drawn->sidebar_fill_height, fill_height);
+        const double max_height = MAX(drawn->sidebar_fill_height, fill_height);
+
+        const cairo_rectangle_t strips[] = {
+            { 0, min_height, max_width, max_height - min_height },
+            { min_width, 0, max_width - min_width, max_height },
+        };
+
+        for (unsigned i = 0; i < sizeof(strips) / sizeof(strips[0]); i++) {
+            const cairo_rectangle_t strip = strips[i];
+            if (strip.width <= 0.0 || strip.height <= 0.0) continue;
+
+            repaint_sidebar(state, strip.x, strip.y, strip.width, strip.height);
+
+            // The clock is on top of the sidebar, so it has to go back on if the strip cut into it
+            if (rects_intersect(&drawn->clock_rect, &strip)) {
+                drawn->clock_str[0] = '\0';
+                set_layer_needs_draw(state, LAYER_CLOCK, true);
+            }
+        }
     }
 
-    // Draw processing indicator
-    if (state->is_processing) {
-        SpinnerAnimation spinner_anim = get_animation_for_key(state, state->spinner_anim_key)->anim.spinner_anim;
+    drawn->sidebar_valid = true;
+    drawn->sidebar_fill_width = fill_width;
+    drawn->sidebar_fill_height = fill_height;
 
-        cairo_save(cr);
+    set_layer_needs_draw(state, LAYER_LOGO, false);
+}
 
-        cairo_translate(cr, field_x, field_y - line_height - 8.0);
+void draw_clock(saver_state_t *state) 
+{
+    cairo_t *cr = state->ctx;
+    render_resources_t *resources = state->resources;
+    glyph_atlas_t *glyphs = &resources->clock_glyphs;
+    drawn_record_t *drawn = &resources->drawn;
+
+    const char *time = state->clock_str;
+    const unsigned length = strlen(time);
+    const int width = glyph_atlas_get_offset(glyphs, time, length);
+    const double x = (kLogoBackgroundWidth - width) / 2;
+    const double y = get_layout(state)->clock_y;
+
+    // Where every character goes. Digits are all the same width, so these only move if the
+    // string changes length.
+    cairo_rectangle_t cells[kMaxClockLength];
+    cairo_rectangle_t clock_rect = { 0 };
+    for (unsigned i = 0; i < length; i++) {
+        cells[i] = glyph_atlas_get_cell(glyphs, time, i, x, y);
+        if (i == 0) {
+            clock_rect = cells[i];
+        } else {
+            clock_rect.width = (cells[i].x + cells[i].width) - clock_rect.x;
+        }
+    }
 
-        // Translate, rotate, translate; so rotation is happening about the center.
-        double tr_amount = (spinner_dimensions.width * spinner_scale_factor) / 2.0;
-        cairo_translate(cr, tr_amount, tr_amount);
-        cairo_rotate(cr, spinner_anim.rotation);
-        cairo_translate(cr, -tr_amount, -tr_amount);
+    const bool layout_changed = (strlen(drawn->clock_str) != length)
+                             || memcmp(&drawn->clock_rect, &clock_rect, sizeof(clock_rect)) != 0;
+    if (layout_changed) {
+        // Erase whatever's left of the previous time, and put all of this one down
+        if (drawn->clock_rect.width > 0.0) {
+            repaint_sidebar(state, drawn->clock_rect.x, drawn->clock_rect.y, drawn->clock_rect.width, drawn->clock_rect.height);
+        }
 
-        cairo_scale(cr, spinner_scale_factor, spinner_scale_factor);
+        for (unsigned i = 0; i < length; i++) {
+            glyph_atlas_paint(glyphs, cr, time[i], x + glyph_atlas_get_offset(glyphs, time, i), y, 1.0);
+        }
 
-        rsvg_handle_render_cairo(state->spinner_svg_handle, cr);
+        add_damage(state, clock_rect.x, clock_rect.y, clock_rect.width, clock_rect.height);
+    } else {
+        // Usually just the last digit or two. Neighbors can reach into a cell, so they're
+        // put back too (only within it).
+        for (unsigned i = 0; i < length; i++) {
+            if (time[i] == drawn->clock_str[i]) continue;
 
-        cairo_restore(cr);
-    }
+            const cairo_rectangle_t cell = snap_to_pixels(state, cells[i]);
+            repaint_sidebar(state, cell.x, cell.y, cell.width, cell.height);
 
-    // Draw password asterisks
-    const double cursor_padding_x = 10.0;
-    if (state->asterisk_svg_handle == NULL) {
-        state->asterisk_svg_handle = load_svg_for_resource_path("/resources/asterisk.svg");
-    }
-
-    RsvgDimensionData dimensions;
-    rsvg_handle_get_dimensions(state->asterisk_svg_handle, &dimensions);
-    
-    const double asterisk_height = cursor_height - 20.0;
-    const double scale_factor = (asterisk_height / dimensions.height);
-    const double scaled_width = (dimensions.width * scale_factor);
-    const double asterisk_width = (scaled_width + cursor_padding_x);
-    const unsigned int num_asterisks = strlen(state->password_buffer);
-
-    if (layer_needs_draw(state, LAYER_PASSWORD)) {
-        // Draw background first
-        draw_background(state, field_x, field_y - (field_padding / 2.0), 
-                        (asterisk_width * num_asterisks), cursor_height + field_padding);
-
-        // Asterisks are all rendered in a single group so their opacity can change (password_opacity)
-        cairo_push_group(cr);
-        double cursor_offset_x = 0.0;
-        for (unsigned i = 0; i < num_asterisks; i++) {
             cairo_save(cr);
-            cairo_translate(cr, field_x + cursor_offset_x, field_y + ((cursor_height - asterisk_height) / 2.0));
-            cairo_scale(cr, scale_factor, scale_factor);
-            rsvg_handle_render_cairo(state->asterisk_svg_handle, cr);
+            cairo_rectangle(cr, cell.x, cell.y, cell.width, cell.height);
+            cairo_clip(cr);
+            for (unsigned j = 0; j < length; j++) {
+                if (rects_intersect(&cells[j], &cell)) {
+                    glyph_atlas_paint(glyphs, cr, time[j], x + glyph_atlas_get_offset(glyphs, time, j), y, 1.0);
+                }
+            }
             cairo_restore(cr);
-
-            cursor_offset_x += asterisk_width;
         }
+    }
 
-        cairo_pattern_t *asterisk_pattern = cairo_pop_group(cr);
+    strncpy(drawn->clock_str, time, kMaxClockLength - 1);
+    drawn->clock_str[kMaxClockLength - 1] = '\0';
+    drawn->clock_rect = clock_rect;
 
-        cairo_save(cr);
-        cairo_set_source(cr, asterisk_pattern);
-        cairo_paint_with_alpha(cr, state->password_opacity);
-        cairo_restore(cr);
-        cairo_pattern_destroy(asterisk_pattern);
+    set_layer_needs_draw(state, LAYER_CLOCK, false);
+}
+
+void draw_password_field(saver_state_t *state)
+{
+    cairo_t *cr = state->ctx;
+    render_resources_t *resources = state->resources;
+    const render_layout_t *layout = get_layout(state);
+
+    const double field_x = layout->field_x;
+    const double field_y = layout->field_y;
+    const double field_padding = layout->field_padding;
+    const double cursor_width = layout->cursor_width;
+    const double cursor_height = layout->cursor_height;
+
+    // The cursor sits after the last asterisk, so it moves whenever the password changes.
+    const bool cursor_needs_draw = layer_needs_draw(state, LAYER_PASSWORD | LAYER_CURSOR);
+
+    // Clear out the previous spinner frame (or the spinner, once we're done processing).
+    // This comes first, since the status text can sit underneath it while there's no spinner.
+    const bool spinner_needs_draw = layer_needs_draw(state, LAYER_PROMPT | LAYER_SPINNER);
+    const double spinner_extent = layout->spinner_extent;
+    if (spinner_needs_draw) {
+        draw_background(state, layout->spinner_center_x - (spinner_extent / 2.0), layout->spinner_center_y - (spinner_extent / 2.0),
+                        spinner_extent, spinner_extent);
+    }
+
+    // Draw status text
+    if (layer_needs_draw(state, LAYER_PROMPT)) {
+        const cairo_rectangle_t prompt_rect = layout->prompt_rect;
+        const double prompt_offset = state->is_processing ? layout->prompt_spinner_offset : 0.0;
+        draw_background(state, prompt_rect.x, prompt_rect.y, prompt_rect.width, prompt_rect.height);
+        text_paint(&resources->prompt_text, cr, prompt_rect.x + prompt_offset, prompt_rect.y, state->password_opacity);
+
+        set_layer_needs_draw(state, LAYER_PROMPT, false);
+    }
+
+    // Draw processing indicator
+    if (spinner_needs_draw && state->is_processing) {
+        SpinnerAnimation spinner_anim = get_animation_for_key(state, state->spinner_anim_key)->anim.spinner_anim;
+        sprite_atlas_paint(&resources->spinner_atlas, cr, layout->spinner_center_x, layout->spinner_center_y,
+                           layout->spinner_width, layout->spinner_height, spinner_anim.frame, 1.0);
+    }
+
+    set_layer_needs_draw(state, LAYER_SPINNER, false);
+
+    // Draw password asterisks
+    const double asterisk_width = layout->asterisk_advance;
+    const unsigned int num_asterisks = state->password_length;
+
+    // Typing only touches the cells that changed. Everything gets drawn again if what's
+    // underneath was (the background), or if it has to look different (opacity, or the
+    // cursor no longer covering the asterisks).
+    drawn_record_t *drawn = &resources->drawn;
+    const bool field_changed = (drawn->password_opacity != state->password_opacity)
+                            || (drawn->password_filled && !state->is_processing);
+    if (layer_needs_draw(state, LAYER_PASSWORD) || field_changed) {
+        const bool redraw_all = field_changed || (state->dirty_layers & LAYER_BACKGROUND);
+        const unsigned first_cell = redraw_all ? 0 : MIN(drawn->password_length, num_asterisks);
+        const unsigned end_cell = MAX(drawn->password_length, num_asterisks);
+
+        // Erase from the first cell that changed through the old cursor
+        draw_background(state, field_x + (asterisk_width * first_cell), field_y - (field_padding / 2.0),
+                        (asterisk_width * (end_cell - first_cell)) + cursor_width, cursor_height + field_padding);
+
+        // Asterisks never overlap, so each one can be blended with the field's opacity
+        // (password_opacity) directly, without composing them in a group first.
+        for (unsigned i = first_cell; i < num_asterisks; i++) {
+            sprite_paint(&resources->asterisk_sprite, cr, field_x + (asterisk_width * i), layout->asterisk_y,
+                         layout->asterisk_width, layout->asterisk_height, state->password_opacity);
+        }
+
+        drawn->password_length = num_asterisks;
+        drawn->password_opacity = state->password_opacity;
+        drawn->password_filled = false;
 
         set_layer_needs_draw(state, LAYER_PASSWORD, false);
     }
 
     // Draw cursor
-    const double x_offset = (num_asterisks * asterisk_width);
-    cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, MIN(state->password_opacity, state->cursor_opacity));
-    draw_background(state, field_x + x_offset, field_y, state->canvas_width, cursor_height);
-    if (!state->is_processing) {
-        cairo_rectangle(cr, field_x + x_offset, field_y, cursor_width, cursor_height);
-    } else {
-        // Fill asterisks
-        cairo_rectangle(cr, field_x, field_y, x_offset, cursor_height);
+    if (cursor_needs_draw || field_changed) {
+        const double x_offset = (num_asterisks * asterisk_width);
+        const double cursor_alpha = MIN(state->password_opacity, state->cursor_opacity);
+        draw_background(state, field_x + x_offset, field_y, cursor_width, cursor_height);
+
+        double cursor_x = field_x + x_offset;
+        double cursor_fill_width = cursor_width;
+        if (state->is_processing) {
+            // Fill asterisks
+            cursor_x = field_x;
+            cursor_fill_width = x_offset;
+            add_damage(state, field_x, field_y, x_offset, cursor_height);
+            drawn->password_filled = true;
+        }
+
+        if (!fill_target_rect(state, cursor_x, field_y, cursor_fill_width, cursor_height, 1.0, 1.0, 1.0, cursor_alpha)) {
+            cairo_set_source_rgba(cr, 1.0, 1.0, 1.0, cursor_alpha);
+            cairo_rectangle(cr, cursor_x, field_y, cursor_fill_width, cursor_height);
+            cairo_fill(cr);
+        }
+
+        set_layer_needs_draw(state, LAYER_CURSOR, false);
     }
-    cairo_fill(cr);
 }
 
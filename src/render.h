@@ -8,10 +8,12 @@
 
 #include "animation.h"
 #include "auth.h"
+#include "sprite.h"
+#include "text.h"
+#include "timer.h"
 
 #include <cairo/cairo.h>
 #include <cairo-xlib.h>
-#include <librsvg/rsvg.h>
 #include <pango/pangocairo.h>
 #include <stdbool.h>
 
@@ -19,47 +21,128 @@
 #define kMaxPasswordLength 128
 #define kMaxPromptLength   128
 #define kMaxClockLength    16
-#define kMaxTimers         16
 
 typedef unsigned animation_key_t;
 #define ANIM_KEY_NOEXIST (kMaxAnimations + 1)
 
+typedef enum {
+    // Layers are composed in an intermediate group, which is then painted onto the
+    // target in one go (avoids showing partially drawn frames on X11).
+    RENDER_MODE_GROUP,
+
+    // Layers draw straight into the target surface.
+    RENDER_MODE_DIRECT,
+} render_mode_t;
+
 typedef enum {
     LAYER_BACKGROUND     = 1 << 0,
     LAYER_PROMPT         = 1 << 1,
     LAYER_LOGO           = 1 << 2,
     LAYER_PASSWORD       = 1 << 3,
     LAYER_CLOCK          = 1 << 4,
+    LAYER_CURSOR         = 1 << 5,
+    LAYER_SPINNER        = 1 << 6,
     ALL_LAYERS           = 0xFF
 } layer_type_t;
 
 
-typedef unsigned int timer_id;
-typedef void (*timer_callback_t)(void *context);
+// What the last frame left on the canvas, so the next one only has to touch what changed.
+// Every plane of a frame starts out from the same record.
+typedef struct {
+    // The time last painted, and where (canvas units), so the next tick can erase just the
+    // characters that changed. Emptied when something else painted over it.
+    char                    clock_str[kMaxClockLength];
+    cairo_rectangle_t       clock_rect;
+
+    // How far the sidebar was filled in (canvas units), so a wipe only paints what it uncovered
+    bool                    sidebar_valid;
+    double                  sidebar_fill_width;
+    double                  sidebar_fill_height;
+
+    // Asterisks in the field, and how they were drawn
+    unsigned int            password_length;
+    double                  password_opacity;
+    bool                    password_filled;    // Covered by the cursor while processing
+} drawn_record_t;
+
+// Where everything goes on the canvas (canvas units). Worked out once, and again only when the
+// canvas changes size or scale, or the prompt changes height.
 typedef struct {
-    bool                    active;
-    anim_time_interval_t    exec_time;
-    timer_callback_t        callback;
-} saver_timer_t;
+    bool                    valid;
+    int                     canvas_width;
+    int                     canvas_height;
+    double                  canvas_scale;
+    int                     prompt_height;
+
+    cairo_rectangle_t       logo_rect;
+    double                  clock_y;
+
+    // The password field: the prompt sits above the row of asterisks, the spinner to the
+    // left of the prompt while processing.
+    double                  field_x;
+    double                  field_y;
+    double                  field_padding;
+    double                  cursor_width;
+    double                  cursor_height;
+
+    cairo_rectangle_t       prompt_rect;
+    double                  prompt_spinner_offset;  // Prompt moves over this far for the spinner
+
+    double                  spinner_center_x;
+    double                  spinner_center_y;
+    double                  spinner_width;
+    double                  spinner_height;
+    double                  spinner_extent;         // Square any frame fits in (with slack)
+
+    double                  asterisk_y;
+    double                  asterisk_width;
+    double                  asterisk_height;
+    double                  asterisk_advance;
+} render_layout_t;
+
+// Everything drawing keeps around between frames. None of it is thread safe, so every
+// thread that draws needs its own set, unless it's been through prepare_render_resources()
+// for the frame (then threads drawing that frame can share the caches).
+typedef struct {
+    text_t                  prompt_text;
+    glyph_atlas_t           clock_glyphs;
+
+    sprite_t                logo_sprite;
+    sprite_t                asterisk_sprite;
+    sprite_t                spinner_sprite;
+    sprite_atlas_t          spinner_atlas;
+
+    // The fully drawn-in sidebar (bar and logo), in device pixels
+    cairo_surface_t        *sidebar_surface;
+    int                     sidebar_pixel_width;
+    int                     sidebar_pixel_height;
+
+    render_layout_t         layout;
+    drawn_record_t          drawn;
+} render_resources_t;
 
 typedef struct {
     cairo_t                *ctx;
     cairo_surface_t        *surface;
-
-    PangoLayout            *pango_layout;
-    PangoFontDescription   *status_font;
-    PangoFontDescription   *clock_font;
+    render_mode_t           render_mode;
+    render_resources_t     *resources;
 
     double                  background_redshift;
 
-    RsvgHandle             *logo_svg_handle;
     double                  logo_fill_width;
     double                  logo_fill_height;
 
-    RsvgHandle             *asterisk_svg_handle;
-
+    // Logical size. The canvas is `canvas_scale` times larger in device pixels; `ctx`
+    // maps one onto the other.
     int                     canvas_width;
     int                     canvas_height;
+    double                  canvas_scale;
+    int                     canvas_pixel_width;
+    int                     canvas_pixel_height;
+
+    // `surface` may only cover part of the canvas, starting at this device pixel
+    int                     target_x;
+    int                     target_y;
 
     bool                    input_allowed;
     double                  cursor_opacity;
@@ -69,11 +152,11 @@ typedef struct {
     bool                    is_authenticated;
 
     timer_id                show_spinner_timer;
-    RsvgHandle             *spinner_svg_handle;
     animation_key_t         spinner_anim_key;
 
     char                    password_prompt[kMaxPromptLength];
     char                    password_buffer[kMaxPasswordLength];
+    unsigned int            password_length;    // Of password_buffer, kept up to date with it
     double                  password_opacity;
 
     bool                    clock_enabled;
@@ -83,13 +166,28 @@ typedef struct {
     animation_t             animations[kMaxAnimations];
     unsigned                num_animations;
 
-    saver_timer_t           timers[kMaxTimers];
+    timer_queue_t           timers;
 
     layer_type_t            dirty_layers;
+    cairo_region_t         *damage;
 
     struct auth_handle_t   *auth_handle;
 } saver_state_t;
 
+// Sets up the SVG sprites and text layouts. `cr` provides the font options text is shaped with.
+void init_render_resources(render_resources_t *resources, cairo_t *cr,
+                           const PangoFontDescription *status_font, const PangoFontDescription *clock_font);
+
+// Sprites and text are rasterized at the size they're drawn at; throw those away when the output changes.
+void invalidate_render_resources(render_resources_t *resources);
+
+// Frees everything init_render_resources() set up
+void destroy_render_resources(render_resources_t *resources);
+
+// Lays out and rasterizes everything drawing the state's frame at its target's scale can use,
+// so drawing it afterwards only reads the resources (besides the drawn record).
+void prepare_render_resources(saver_state_t *state);
+
 // Use this to set the prompt ("Password: ")
 void set_password_prompt(saver_state_t *state, const char *prompt);
 
@@ -105,13 +203,26 @@ animation_t* get_animation_for_key(saver_state_t *state, animation_key_t anim_ke
 // Update all running animations
 void update_animations(saver_state_t *state);
 
+// Returns the next time any running animation will change what's on screen
+// (`now` if one is mid-transition, ANIM_TIME_NEVER if all are idle)
+anim_time_interval_t next_animation_deadline(saver_state_t *state);
+
 // Background
 void draw_background(saver_state_t *state, double x, double y, double width, double height);
 
-// The purple sidebar
+void get_background_color(saver_state_t *state, double *r, double *g, double *b);
+
+// Parts of the canvas (logical units) anything other than the background gets drawn in.
+// Returns the number of rects written to `rects`.
+unsigned int get_content_rects(int canvas_width, int canvas_height, cairo_rectangle_int_t *rects, unsigned int max_rects);
+
+// Background for the whole canvas, except wherever the sidebar already covers it
+void draw_full_background(saver_state_t *state);
+
+// The purple sidebar. Once it's fully drawn in, this is a copy from a retained surface.
 void draw_logo(saver_state_t *state);
 
-// The clock, colocated in the sidebar
+// The clock, colocated in the sidebar. Only the pixels under the old and new time are touched.
 void draw_clock(saver_state_t *state);
 
 // The status string and paassword field
@@ -122,3 +233,10 @@ bool layer_needs_draw(saver_state_t *state, const layer_type_t type);
 
 // Convenience function for setting layer dirty state
 void set_layer_needs_draw(saver_state_t *state, const layer_type_t type, bool needs_draw);
+
+// Record that a rect of the canvas was drawn to this frame. Only damaged pixels are
+// composited and sent to the display server. The damage region is kept in device pixels.
+void add_damage(saver_state_t *state, double x, double y, double width, double height);
+
+// Call once the accumulated damage has been committed
+void clear_damage(saver_state_t *state);
@@ -0,0 +1,518 @@
+/*
+ * render_pool.c
+ *
+ * Worker threads that render each view's frame in parallel
+ */
+
+#include "render_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *kRenderTilesEnvVar = "BUZZLOCKER_RENDER_TILES";
+
+// Bands smaller than this aren't worth a thread of their own
+static const long kMinTilePixels = 1024 * 1024;
+
+static void draw(saver_state_t *state)
+{
+    if (layer_needs_draw(state, LAYER_BACKGROUND)) {
+        draw_full_background(state);
+    }
+
+    if (layer_needs_draw(state, LAYER_LOGO)) {
+        draw_logo(state);
+    }
+
+    if (state->clock_enabled && layer_needs_draw(state, LAYER_CLOCK)) {
+        draw_clock(state);
+    }
+
+    draw_password_field(state);
+
+    // Automatically reset this after every draw call. Anything still marked dirty
+    // at this point (e.g., the clock layer when the clock is disabled) has nothing
+    // to draw, and would otherwise keep the runloop from going idle.
+    set_layer_needs_draw(state, ALL_LAYERS, false);
+}
+
+static void set_render_target(saver_state_t *state, const display_plane_t *plane)
+{
+    // Backends with more than one buffer hand us different surfaces every frame, and contexts
+    // are cheap next to drawing, so there's no point holding on to one.
+    cairo_destroy(state->ctx);
+    state->ctx = cairo_create(plane->surface);
+    state->surface = plane->surface;
+    state->target_x = plane->rect.x;
+    state->target_y = plane->rect.y;
+
+    // Everything is laid out in logical pixels of the whole canvas. Sprites and text measure
+    // the CTM, so they rasterize at the target's full resolution.
+    cairo_translate(state->ctx, -plane->rect.x, -plane->rect.y);
+    cairo_scale(state->ctx, state->canvas_scale, state->canvas_scale);
+}
+
+static void render_frame(saver_state_t *state)
+{
+    cairo_t *cr = state->ctx;
+    if (state->render_mode == RENDER_MODE_DIRECT) {
+        draw(state);
+    } else {
+        cairo_push_group(cr);
+        draw(state);
+        cairo_pop_group_to_source(cr);
+
+        // Only composite what was actually drawn (damage is in canvas device pixels)
+        cairo_save(cr);
+        cairo_scale(cr, 1.0 / state->canvas_scale, 1.0 / state->canvas_scale);
+        const int num_rects = cairo_region_num_rectangles(state->damage);
+        for (int i = 0; i < num_rects; i++) {
+            cairo_rectangle_int_t rect;
+            cairo_region_get_rectangle(state->damage, i, &rect);
+            cairo_rectangle(cr, rect.x, rect.y, rect.width, rect.height);
+        }
+        cairo_clip(cr);
+        cairo_paint(cr);
+        cairo_restore(cr);
+    }
+
+    cairo_surface_flush(state->surface);
+}
+
+// Copies what drawing reads from `src` into `dst`. The rest (the password, timers, the auth
+// handle) never leaves the main thread, and what belongs to the thread drawing `dst` (its
+// context, target, damage and resources) is left alone.
+static void copy_state(saver_state_t *dst, const saver_state_t *src)
+{
+    dst->render_mode = src->render_mode;
+    dst->background_redshift = src->background_redshift;
+    dst->logo_fill_width = src->logo_fill_width;
+    dst->logo_fill_height = src->logo_fill_height;
+
+    dst->canvas_width = src->canvas_width;
+    dst->canvas_height = src->canvas_height;
+    dst->canvas_scale = src->canvas_scale;
+    dst->canvas_pixel_width = src->canvas_pixel_width;
+    dst->canvas_pixel_height = src->canvas_pixel_height;
+
+    dst->cursor_opacity = src->cursor_opacity;
+    dst->is_processing = src->is_processing;
+    dst->spinner_anim_key = src->spinner_anim_key;
+    memcpy(dst->animations, src->animations, sizeof(dst->animations));
+    dst->num_animations = src->num_animations;
+
+    memcpy(dst->password_prompt, src->password_prompt, sizeof(dst->password_prompt));
+    dst->password_length = src->password_length;
+    dst->password_opacity = src->password_opacity;
+
+    dst->clock_enabled = src->clock_enabled;
+    memcpy(dst->clock_str, src->clock_str, sizeof(dst->clock_str));
+
+    dst->dirty_layers = src->dirty_layers;
+}
+
+// `resources_initialized` is NULL for resources borrowed from another thread, already set up
+static void render_plane(render_pool_t *pool, saver_state_t *state, bool *resources_initialized,
+                         const display_plane_t *plane, layer_type_t layers)
+{
+    set_render_target(state, plane);
+
+    // Created on this thread, so Pango uses this thread's font map
+    if (resources_initialized != NULL && !*resources_initialized) {
+        init_render_resources(state->resources, state->ctx, pool->status_font, pool->clock_font);
+        *resources_initialized = true;
+    }
+
+    state->dirty_layers = layers;
+    render_frame(state);
+}
+
+static void* render_tile_main(void *arg)
+{
+    render_tile_t *tile = (render_tile_t *)arg;
+    render_worker_t *worker = tile->worker;
+
+    pthread_mutex_lock(&worker->tile_lock);
+    for (;;) {
+        while (!tile->has_job && !worker->tiles_shutting_down) {
+            pthread_cond_wait(&tile->job_cond, &worker->tile_lock);
+        }
+
+        if (!tile->has_job) {
+            break;
+        }
+
+        pthread_mutex_unlock(&worker->tile_lock);
+        render_plane(worker->pool, &tile->state, NULL, &tile->plane, tile->layers);
+        pthread_mutex_lock(&worker->tile_lock);
+
+        tile->has_job = false;
+        if (--worker->tiles_pending == 0) {
+            pthread_cond_signal(&worker->tiles_done_cond);
+        }
+    }
+    pthread_mutex_unlock(&worker->tile_lock);
+
+    return NULL;
+}
+
+// How many bands to split drawing `layers` into `plane` into
+static unsigned int get_num_tiles(const render_pool_t *pool, const display_plane_t *plane, layer_type_t layers)
+{
+    // Only repaints of the whole plane are big enough to be worth it, and the bands have to
+    // point into image memory
+    if (!(layers & LAYER_BACKGROUND) || cairo_surface_get_type(plane->surface) != CAIRO_SURFACE_TYPE_IMAGE) {
+        return 1;
+    }
+
+    const long num_pixels = (long)plane->rect.width * plane->rect.height;
+    const long num_tiles = MIN(MIN((long)pool->max_tiles, num_pixels / kMinTilePixels), (long)plane->rect.height);
+    return MAX(1, num_tiles);
+}
+
+// Starts one more of the worker's tiles. Call with the tile lock held.
+static bool start_tile(render_worker_t *worker)
+{
+    if (worker->tile_start_failed) {
+        return false;
+    }
+
+    render_tile_t *tile = &worker->tiles[worker->num_tiles_started];
+    if (pthread_create(&tile->thread, NULL, render_tile_main, tile) != 0) {
+        fprintf(stderr, "Error creating render tile thread, drawing its bands on the view's thread\n");
+        worker->tile_start_failed = true;
+        return false;
+    }
+
+    tile->started = true;
+    worker->num_tiles_started++;
+    return true;
+}
+
+// Splits the plane into `num_tiles` horizontal bands and draws them at the same time: the first
+// one on this thread, the rest on the worker's tiles. They all start from the same state, so
+// they come out just like drawing the plane in one go would, and damage from all of them ends
+// up in the worker's state. Sprites, text and the retained sidebar are rasterized here first,
+// and the tiles draw from the worker's copies.
+static void render_plane_tiled(render_worker_t *worker, const display_plane_t *plane,
+                               const drawn_record_t *drawn, unsigned int num_tiles)
+{
+    saver_state_t *state = &worker->state;
+    cairo_surface_t *surface = plane->surface;
+    cairo_surface_flush(surface);
+
+    unsigned char *data = cairo_image_surface_get_data(surface);
+    const cairo_format_t format = cairo_image_surface_get_format(surface);
+    const int stride = cairo_image_surface_get_stride(surface);
+    const int band_height = (plane->rect.height + num_tiles - 1) / num_tiles;
+
+    display_plane_t bands[kMaxRenderTiles];
+    unsigned int num_bands = 0;
+    for (int y = 0; y < plane->rect.height && num_bands < num_tiles; y += band_height) {
+        const int height = MIN(band_height, plane->rect.height - y);
+        bands[num_bands++] = (display_plane_t) {
+            .surface = cairo_image_surface_create_for_data(data + ((size_t)y * stride), format, plane->rect.width, height, stride),
+            .rect = { plane->rect.x, plane->rect.y + y, plane->rect.width, height },
+        };
+    }
+
+    // Everything the bands draw from is set up once, on this thread, at the bands' scale
+    set_render_target(state, &bands[0]);
+    if (!worker->resources_initialized) {
+        init_render_resources(&worker->resources, state->ctx, worker->pool->status_font, worker->pool->clock_font);
+        worker->resources_initialized = true;
+    }
+
+    worker->resources.drawn = *drawn;
+    prepare_render_resources(state);
+
+    pthread_mutex_lock(&worker->tile_lock);
+
+    while (worker->num_tiles_started < num_bands - 1 && start_tile(worker)) {
+    }
+
+    const unsigned int num_helpers = MIN(num_bands - 1, worker->num_tiles_started);
+    for (unsigned int i = 0; i < num_helpers; i++) {
+        render_tile_t *tile = &worker->tiles[i];
+        copy_state(&tile->state, state);
+        clear_damage(&tile->state);
+
+        // Only the drawn record is the tile's own; it changes as the band is drawn
+        tile->resources = worker->resources;
+        tile->plane = bands[i + 1];
+        tile->layers = worker->layers;
+        tile->has_job = true;
+        pthread_cond_signal(&tile->job_cond);
+    }
+    worker->tiles_pending = num_helpers;
+
+    pthread_mutex_unlock(&worker->tile_lock);
+
+    // The first band, and any that didn't get a thread
+    for (unsigned int i = 0; i < num_bands; i++) {
+        if (i > 0 && i <= num_helpers) continue;
+
+        worker->resources.drawn = *drawn;
+        render_plane(worker->pool, state, &worker->resources_initialized, &bands[i], worker->layers);
+    }
+
+    pthread_mutex_lock(&worker->tile_lock);
+    while (worker->tiles_pending > 0) {
+        pthread_cond_wait(&worker->tiles_done_cond, &worker->tile_lock);
+    }
+    pthread_mutex_unlock(&worker->tile_lock);
+
+    for (unsigned int i = 0; i < num_helpers; i++) {
+        cairo_region_union(state->damage, worker->tiles[i].state.damage);
+    }
+
+    for (unsigned int i = 0; i < num_bands; i++) {
+        cairo_surface_destroy(bands[i].surface);
+    }
+
+    cairo_surface_mark_dirty(surface);
+}
+
+static void render_job(render_pool_t *pool, render_worker_t *worker)
+{
+    saver_state_t *state = &worker->state;
+
+    struct timespec render_start, render_end;
+    clock_gettime(CLOCK_MONOTONIC, &render_start);
+
+    // Each plane shows its own part of the canvas. Drawing is clipped to the plane, and
+    // damage accumulates over all of them in canvas coordinates.
+    const drawn_record_t drawn = worker->resources.drawn;
+    for (unsigned int i = 0; i < worker->num_planes; i++) {
+        const display_plane_t *plane = &worker->planes[i];
+        const unsigned int num_tiles = get_num_tiles(pool, plane, worker->layers);
+        if (num_tiles > 1) {
+            render_plane_tiled(worker, plane, &drawn, num_tiles);
+        } else {
+            worker->resources.drawn = drawn;
+            render_plane(pool, state, &worker->resources_initialized, plane, worker->layers);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &render_end);
+    worker->render_usec = ((render_end.tv_sec - render_start.tv_sec) * 1000000.0)
+                        + ((render_end.tv_nsec - render_start.tv_nsec) / 1000.0);
+}
+
+static void* render_worker_main(void *arg)
+{
+    render_worker_t *worker = (render_worker_t *)arg;
+    render_pool_t *pool = worker->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!worker->has_job && !pool->shutting_down) {
+            pthread_cond_wait(&worker->job_cond, &pool->lock);
+        }
+
+        if (!worker->has_job) {
+            break;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        render_job(pool, worker);
+        pthread_mutex_lock(&pool->lock);
+
+        worker->has_job = false;
+        worker->frame_ready = true;
+        if (--pool->num_pending == 0) {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+// One thread per core, unless overridden
+static unsigned int get_max_tiles(void)
+{
+    long max_tiles = sysconf(_SC_NPROCESSORS_ONLN);
+
+    const char *env_tiles = getenv(kRenderTilesEnvVar);
+    if (env_tiles != NULL) {
+        max_tiles = strtol(env_tiles, NULL, 10);
+    }
+
+    return MAX(1, MIN(max_tiles, kMaxRenderTiles));
+}
+
+void render_pool_init(render_pool_t *pool, const PangoFontDescription *status_font, const PangoFontDescription *clock_font)
+{
+    *pool = (render_pool_t) {
+        .status_font = status_font,
+        .clock_font = clock_font,
+        .max_tiles = get_max_tiles(),
+    };
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (unsigned i = 0; i < kMaxViews; i++) {
+        render_worker_t *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->state.damage = cairo_region_create();
+        worker->state.resources = &worker->resources;
+        pthread_cond_init(&worker->job_cond, NULL);
+
+        pthread_mutex_init(&worker->tile_lock, NULL);
+        pthread_cond_init(&worker->tiles_done_cond, NULL);
+        for (unsigned t = 0; t < kMaxRenderTiles - 1; t++) {
+            render_tile_t *tile = &worker->tiles[t];
+            tile->worker = worker;
+            tile->state.damage = cairo_region_create();
+            tile->state.resources = &tile->resources;
+            pthread_cond_init(&tile->job_cond, NULL);
+        }
+    }
+}
+
+void render_pool_submit(render_pool_t *pool, unsigned int view, const saver_state_t *state,
+                        const display_plane_t *planes, unsigned int num_planes,
+                        const display_bounds_t *bounds, layer_type_t layers)
+{
+    render_worker_t *worker = &pool->workers[view];
+
+    pthread_mutex_lock(&pool->lock);
+
+    // Xlib surfaces (and everything cairo makes similar to them) all go through the one display
+    // connection, which isn't thread safe. Views drawn into them are drawn here, one at a time.
+    bool draw_inline = false;
+    for (unsigned int i = 0; i < num_planes; i++) {
+        draw_inline |= (cairo_surface_get_type(planes[i].surface) == CAIRO_SURFACE_TYPE_XLIB);
+    }
+
+    if (!worker->started && !draw_inline) {
+        if (pthread_create(&worker->thread, NULL, render_worker_main, worker) == 0) {
+            worker->started = true;
+        } else {
+            fprintf(stderr, "Error creating render thread, rendering view %u on the main thread\n", view);
+        }
+    }
+
+    // Called from the main thread, which is the only one that changes the state (the auth
+    // thread's prompts are applied there too), so nothing can change while it's copied
+    saver_state_t *snapshot = &worker->state;
+    copy_state(snapshot, state);
+    snapshot->canvas_width = bounds->width;
+    snapshot->canvas_height = bounds->height;
+    snapshot->canvas_scale = bounds->scale;
+    snapshot->canvas_pixel_width = bounds->pixel_width;
+    snapshot->canvas_pixel_height = bounds->pixel_height;
+    snapshot->dirty_layers = layers;
+
+    memcpy(worker->planes, planes, num_planes * sizeof(display_plane_t));
+    worker->num_planes = num_planes;
+    worker->layers = layers;
+
+    if (!worker->started || draw_inline) {
+        pthread_mutex_unlock(&pool->lock);
+        render_job(pool, worker);
+        worker->frame_ready = true;
+        return;
+    }
+
+    worker->has_job = true;
+    pool->num_pending++;
+    pthread_cond_signal(&worker->job_cond);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void render_pool_wait(render_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->num_pending > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+saver_state_t* render_pool_take_frame(render_pool_t *pool, unsigned int view, double *render_usec)
+{
+    render_worker_t *worker = &pool->workers[view];
+
+    pthread_mutex_lock(&pool->lock);
+    const bool frame_ready = worker->frame_ready;
+    worker->frame_ready = false;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!frame_ready) {
+        return NULL;
+    }
+
+    if (render_usec != NULL) {
+        *render_usec = worker->render_usec;
+    }
+
+    return &worker->state;
+}
+
+void render_pool_invalidate_resources(render_pool_t *pool)
+{
+    for (unsigned i = 0; i < kMaxViews; i++) {
+        render_worker_t *worker = &pool->workers[i];
+        if (worker->resources_initialized) {
+            invalidate_render_resources(&worker->resources);
+        }
+    }
+}
+
+void render_pool_destroy(render_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = true;
+    for (unsigned i = 0; i < kMaxViews; i++) {
+        pthread_cond_signal(&pool->workers[i].job_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned i = 0; i < kMaxViews; i++) {
+        render_worker_t *worker = &pool->workers[i];
+        if (worker->started) {
+            pthread_join(worker->thread, NULL);
+        }
+
+        if (worker->resources_initialized) {
+            destroy_render_resources(&worker->resources);
+            worker->resources_initialized = false;
+        }
+
+        cairo_destroy(worker->state.ctx);
+        cairo_region_destroy(worker->state.damage);
+        pthread_cond_destroy(&worker->job_cond);
+
+        pthread_mutex_lock(&worker->tile_lock);
+        worker->tiles_shutting_down = true;
+        for (unsigned t = 0; t < worker->num_tiles_started; t++) {
+            pthread_cond_signal(&worker->tiles[t].job_cond);
+        }
+        pthread_mutex_unlock(&worker->tile_lock);
+
+        for (unsigned t = 0; t < kMaxRenderTiles - 1; t++) {
+            render_tile_t *tile = &worker->tiles[t];
+            if (tile->started) {
+                pthread_join(tile->thread, NULL);
+            }
+
+            cairo_destroy(tile->state.ctx);
+            cairo_region_destroy(tile->state.damage);
+            pthread_cond_destroy(&tile->job_cond);
+        }
+
+        pthread_cond_destroy(&worker->tiles_done_cond);
+        pthread_mutex_destroy(&worker->tile_lock);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_mutex_destroy(&pool->lock);
+}
@@ -0,0 +1,107 @@
+/*
+ * render_pool.h
+ *
+ * Worker threads that render each view's frame in parallel
+ */
+
+#pragma once
+
+#include "display_server.h"
+#include "render.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// Most threads that ever draw one plane at the same time
+#define kMaxRenderTiles 8
+
+struct render_pool_t;
+struct render_worker_t;
+
+// Draws one horizontal band of a large plane on its own thread, alongside the view's worker,
+// when the whole plane has to be repainted. The band is an image surface of its own over the
+// plane's pixels, so the target isn't shared between threads. Tiles keep their own state, but
+// draw from the worker's rasterized sprites and text (prepared before the bands are handed out).
+typedef struct {
+    struct render_worker_t *worker;
+    pthread_t               thread;
+    pthread_cond_t          job_cond;
+    bool                    started;
+
+    saver_state_t           state;
+    render_resources_t      resources;  // The worker's, copied in for each band; only `drawn` is the tile's
+
+    display_plane_t         plane;      // The band
+    layer_type_t            layers;
+    bool                    has_job;
+} render_tile_t;
+
+// One per view, started the first time the view has a frame to render.
+typedef struct render_worker_t {
+    struct render_pool_t   *pool;
+    pthread_t               thread;
+    pthread_cond_t          job_cond;
+    bool                    started;
+
+    // The worker draws from its own copy of the saver state (taken when the frame is
+    // submitted), with its own context, damage, and resources.
+    saver_state_t           state;
+    render_resources_t      resources;
+    bool                    resources_initialized;
+
+    display_plane_t         planes[kMaxPlanes];
+    unsigned int            num_planes;
+    layer_type_t            layers;
+    bool                    has_job;
+
+    // Set once the frame is drawn, until it's taken with render_pool_take_frame()
+    bool                    frame_ready;
+    double                  render_usec;
+
+    // Helpers for the other bands of tiled planes, started the first time they're needed.
+    // Guarded by `tile_lock` rather than the pool's lock.
+    render_tile_t           tiles[kMaxRenderTiles - 1];
+    unsigned int            num_tiles_started;
+    pthread_mutex_t         tile_lock;
+    pthread_cond_t          tiles_done_cond;
+    unsigned int            tiles_pending;
+    bool                    tiles_shutting_down;
+    bool                    tile_start_failed;
+} render_worker_t;
+
+typedef struct render_pool_t {
+    pthread_mutex_t         lock;
+    pthread_cond_t          done_cond;
+    unsigned                num_pending;
+    bool                    shutting_down;
+
+    const PangoFontDescription *status_font;
+    const PangoFontDescription *clock_font;
+
+    // How many threads repaint a large plane (1 turns tiling off)
+    unsigned int            max_tiles;
+
+    render_worker_t         workers[kMaxViews];
+} render_pool_t;
+
+void render_pool_init(render_pool_t *pool, const PangoFontDescription *status_font, const PangoFontDescription *clock_font);
+
+// Starts drawing `layers` of `state` into the view's `planes` on its worker, and returns immediately.
+// `state` is copied, so it can change as soon as this returns. Planes on Xlib surfaces are drawn
+// before this returns instead, since they share the display connection.
+void render_pool_submit(render_pool_t *pool, unsigned int view, const saver_state_t *state,
+                        const display_plane_t *planes, unsigned int num_planes,
+                        const display_bounds_t *bounds, layer_type_t layers);
+
+// Blocks until every submitted frame is drawn
+void render_pool_wait(render_pool_t *pool);
+
+// Returns the worker's state after drawing the view's frame (for its damage), or NULL if
+// there's no new frame. The damage has to be cleared once the frame is committed.
+saver_state_t* render_pool_take_frame(render_pool_t *pool, unsigned int view, double *render_usec);
+
+// Drops every worker's rasterized sprites and text. Only call while the pool is idle.
+void render_pool_invalidate_resources(render_pool_t *pool);
+
+// Stops and joins all workers
+void render_pool_destroy(render_pool_t *pool);
@@ -0,0 +1,286 @@
+/*
+ * sprite.c
+ *
+ * SVG resources, rasterized once per size and then drawn as plain blits
+ */
+
+#include "sprite.h"
+#include "resources.h"
+
+#include <gio/gio.h>
+#include <math.h>
+#include <stdio.h>
+
+static GBytes* get_data_for_resource(const char *resource_path)
+{
+    GBytes *result = NULL;
+    GError *error = NULL;
+
+    GResource *resource = as_get_resource();
+    result = g_resource_lookup_data(
+        resource,
+        resource_path,
+        G_RESOURCE_LOOKUP_FLAGS_NONE,
+        &error
+    );
+
+    if (error != NULL) {
+        fprintf(stderr, "Error loading resource %s\n", resource_path);
+    }
+
+    return result;
+}
+
+static RsvgHandle* load_svg_for_resource_path(const char *resource_path)
+{
+    GError *error = NULL;
+    GBytes *bytes = get_data_for_resource(resource_path);
+    RsvgHandle *handle = NULL;
+
+    gsize size = 0;
+    gconstpointer data = g_bytes_get_data(bytes, &size);
+    handle = rsvg_handle_new_from_data(data, size, &error);
+    g_bytes_unref(bytes);
+    if (error != NULL) {
+        fprintf(stderr, "Error loading SVG at resource path: %s\n", resource_path);
+    }
+
+    return handle;
+}
+
+static bool sprite_load(sprite_t *sprite)
+{
+    if (sprite->svg_handle == NULL) {
+        sprite->svg_handle = load_svg_for_resource_path(sprite->resource_path);
+        if (sprite->svg_handle == NULL) {
+            return false;
+        }
+
+        rsvg_handle_get_dimensions(sprite->svg_handle, &sprite->dimensions);
+    }
+
+    return true;
+}
+
+static bool sprite_rasterize(sprite_t *sprite, cairo_surface_t *target, int pixel_width, int pixel_height)
+{
+    sprite_invalidate(sprite);
+
+    if (!sprite_load(sprite) || sprite->dimensions.width == 0 || sprite->dimensions.height == 0) {
+        return false;
+    }
+
+    // Similar to the target, so blits don't need a format conversion (or, on X11, an upload).
+    sprite->surface = cairo_surface_create_similar(target, CAIRO_CONTENT_COLOR_ALPHA, pixel_width, pixel_height);
+    if (cairo_surface_status(sprite->surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(sprite->surface);
+        sprite->surface = NULL;
+        return false;
+    }
+
+    cairo_t *cr = cairo_create(sprite->surface);
+    cairo_scale(cr, (double)pixel_width / sprite->dimensions.width, (double)pixel_height / sprite->dimensions.height);
+    rsvg_handle_render_cairo(sprite->svg_handle, cr);
+    cairo_destroy(cr);
+
+    sprite->pixel_width = pixel_width;
+    sprite->pixel_height = pixel_height;
+
+    return true;
+}
+
+static double get_device_scale(cairo_t *cr)
+{
+    // How many device pixels one unit of user space covers (accounts for any scale or rotation)
+    double dx = 1.0, dy = 0.0;
+    cairo_user_to_device_distance(cr, &dx, &dy);
+    return hypot(dx, dy);
+}
+
+void sprite_init(sprite_t *sprite, const char *resource_path)
+{
+    *sprite = (sprite_t) { 0 };
+    sprite->resource_path = resource_path;
+}
+
+RsvgDimensionData sprite_get_dimensions(sprite_t *sprite)
+{
+    sprite_load(sprite);
+    return sprite->dimensions;
+}
+
+// Makes sure the sprite is rasterized for drawing at `width` x `height` on `cr`
+static bool sprite_update(sprite_t *sprite, cairo_t *cr, double width, double height, double *device_scale)
+{
+    *device_scale = get_device_scale(cr);
+    if (*device_scale <= 0.0) {
+        return false;
+    }
+
+    const int pixel_width = (int)ceil(width * *device_scale);
+    const int pixel_height = (int)ceil(height * *device_scale);
+    if (pixel_width <= 0 || pixel_height <= 0) {
+        return false;
+    }
+
+    if (sprite->surface == NULL || sprite->pixel_width != pixel_width || sprite->pixel_height != pixel_height) {
+        return sprite_rasterize(sprite, cairo_get_target(cr), pixel_width, pixel_height);
+    }
+
+    return true;
+}
+
+void sprite_prepare(sprite_t *sprite, cairo_t *cr, double width, double height)
+{
+    double device_scale;
+    sprite_update(sprite, cr, width, height, &device_scale);
+}
+
+void sprite_paint(sprite_t *sprite, cairo_t *cr, double x, double y, double width, double height, double alpha)
+{
+    double device_scale;
+    if (!sprite_update(sprite, cr, width, height, &device_scale)) {
+        return;
+    }
+
+    // Land on whole pixels, so the blit doesn't resample
+    cairo_save(cr);
+    cairo_translate(cr, round(x * device_scale) / device_scale, round(y * device_scale) / device_scale);
+    cairo_scale(cr, 1.0 / device_scale, 1.0 / device_scale);
+    cairo_set_source_surface(cr, sprite->surface, 0, 0);
+    cairo_paint_with_alpha(cr, alpha);
+    cairo_restore(cr);
+}
+
+void sprite_invalidate(sprite_t *sprite)
+{
+    if (sprite->surface != NULL) {
+        cairo_surface_destroy(sprite->surface);
+        sprite->surface = NULL;
+    }
+
+    sprite->pixel_width = 0;
+    sprite->pixel_height = 0;
+}
+
+void sprite_destroy(sprite_t *sprite)
+{
+    sprite_invalidate(sprite);
+
+    if (sprite->svg_handle != NULL) {
+        g_object_unref(sprite->svg_handle);
+        sprite->svg_handle = NULL;
+    }
+}
+
+/* Rotation atlas */
+
+static bool sprite_atlas_render(sprite_atlas_t *atlas, cairo_surface_t *target, int pixel_width, int pixel_height)
+{
+    sprite_atlas_invalidate(atlas);
+
+    sprite_t *sprite = atlas->sprite;
+    if (!sprite_load(sprite) || sprite->dimensions.width == 0 || sprite->dimensions.height == 0) {
+        return false;
+    }
+
+    const int frame_size = (int)ceil(sprite_atlas_get_frame_extent(pixel_width, pixel_height));
+    atlas->surface = cairo_surface_create_similar(target, CAIRO_CONTENT_COLOR_ALPHA, frame_size * atlas->num_frames, frame_size);
+    if (cairo_surface_status(atlas->surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(atlas->surface);
+        atlas->surface = NULL;
+        return false;
+    }
+
+    // Rendered straight from the SVG, so rotated frames don't resample the upright one.
+    cairo_t *cr = cairo_create(atlas->surface);
+    for (unsigned i = 0; i < atlas->num_frames; i++) {
+        cairo_save(cr);
+        cairo_translate(cr, (i * frame_size) + (frame_size / 2.0), frame_size / 2.0);
+        cairo_rotate(cr, (2.0 * M_PI * i) / atlas->num_frames);
+        cairo_translate(cr, -pixel_width / 2.0, -pixel_height / 2.0);
+        cairo_scale(cr, (double)pixel_width / sprite->dimensions.width, (double)pixel_height / sprite->dimensions.height);
+        rsvg_handle_render_cairo(sprite->svg_handle, cr);
+        cairo_restore(cr);
+    }
+    cairo_destroy(cr);
+
+    atlas->frame_size = frame_size;
+    atlas->pixel_width = pixel_width;
+    atlas->pixel_height = pixel_height;
+
+    return true;
+}
+
+void sprite_atlas_init(sprite_atlas_t *atlas, sprite_t *sprite, unsigned num_frames)
+{
+    *atlas = (sprite_atlas_t) { 0 };
+    atlas->sprite = sprite;
+    atlas->num_frames = num_frames;
+}
+
+double sprite_atlas_get_frame_extent(double width, double height)
+{
+    // Rotated, the sprite can reach out as far as the corners of its bounding box.
+    return hypot(width, height);
+}
+
+static bool sprite_atlas_update(sprite_atlas_t *atlas, cairo_t *cr, double width, double height, double *device_scale)
+{
+    *device_scale = get_device_scale(cr);
+    if (*device_scale <= 0.0) {
+        return false;
+    }
+
+    const int pixel_width = (int)ceil(width * *device_scale);
+    const int pixel_height = (int)ceil(height * *device_scale);
+    if (pixel_width <= 0 || pixel_height <= 0) {
+        return false;
+    }
+
+    if (atlas->surface == NULL || atlas->pixel_width != pixel_width || atlas->pixel_height != pixel_height) {
+        return sprite_atlas_render(atlas, cairo_get_target(cr), pixel_width, pixel_height);
+    }
+
+    return true;
+}
+
+void sprite_atlas_prepare(sprite_atlas_t *atlas, cairo_t *cr, double width, double height)
+{
+    double device_scale;
+    sprite_atlas_update(atlas, cr, width, height, &device_scale);
+}
+
+void sprite_atlas_paint(sprite_atlas_t *atlas, cairo_t *cr, double center_x, double center_y,
+                        double width, double height, unsigned frame, double alpha)
+{
+    double device_scale;
+    if (!sprite_atlas_update(atlas, cr, width, height, &device_scale)) {
+        return;
+    }
+
+    const int frame_size = atlas->frame_size;
+    const double origin_x = round((center_x * device_scale) - (frame_size / 2.0));
+    const double origin_y = round((center_y * device_scale) - (frame_size / 2.0));
+
+    cairo_save(cr);
+    cairo_scale(cr, 1.0 / device_scale, 1.0 / device_scale);
+    cairo_translate(cr, origin_x, origin_y);
+    cairo_rectangle(cr, 0, 0, frame_size, frame_size);
+    cairo_clip(cr);
+    cairo_set_source_surface(cr, atlas->surface, -(double)((frame % atlas->num_frames) * frame_size), 0);
+    cairo_paint_with_alpha(cr, alpha);
+    cairo_restore(cr);
+}
+
+void sprite_atlas_invalidate(sprite_atlas_t *atlas)
+{
+    if (atlas->surface != NULL) {
+        cairo_surface_destroy(atlas->surface);
+        atlas->surface = NULL;
+    }
+
+    atlas->frame_size = 0;
+    atlas->pixel_width = 0;
+    atlas->pixel_height = 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * sprite.h
+ *
+ * SVG resources, rasterized once per size and then drawn as plain blits
+ */
+
+#pragma once
+
+#include <cairo/cairo.h>
+#include <librsvg/rsvg.h>
+#include <stdbool.h>
+
+typedef struct {
+    const char             *resource_path;
+    RsvgHandle             *svg_handle;
+    RsvgDimensionData       dimensions;
+
+    // Rasterized copy of the SVG, `pixel_width` x `pixel_height` device pixels.
+    cairo_surface_t        *surface;
+    int                     pixel_width;
+    int                     pixel_height;
+} sprite_t;
+
+// Pre-rotated copies of a sprite, so spinning it is a blit instead of a resample every frame.
+// Frame `i` is rotated by (2π * i / num_frames), and all of them share one strip surface.
+typedef struct {
+    sprite_t               *sprite;
+    unsigned                num_frames;
+
+    cairo_surface_t        *surface;
+    int                     frame_size;     // Each frame is a square this many device pixels across
+    int                     pixel_width;    // Size of the (unrotated) sprite the frames were made for
+    int                     pixel_height;
+} sprite_atlas_t;
+
+// The SVG is loaded lazily, the first time the sprite is measured or drawn.
+void sprite_init(sprite_t *sprite, const char *resource_path);
+
+// Intrinsic size of the SVG document
+RsvgDimensionData sprite_get_dimensions(sprite_t *sprite);
+
+// Rasterizes the sprite for drawing at `width` x `height` on `cr`, without drawing it. Painting
+// it at that size afterwards only reads the sprite, so several threads can share it.
+void sprite_prepare(sprite_t *sprite, cairo_t *cr, double width, double height);
+
+// Draws the sprite scaled to `width` x `height` (user space) at `x`, `y`. The SVG is only
+// rasterized again if that works out to a different size in device pixels.
+void sprite_paint(sprite_t *sprite, cairo_t *cr, double x, double y, double width, double height, double alpha);
+
+// Drops the rasterized copy. Call when the output changes size or scale.
+void sprite_invalidate(sprite_t *sprite);
+
+// Frees the rasterized copy and the SVG
+void sprite_destroy(sprite_t *sprite);
+
+void sprite_atlas_init(sprite_atlas_t *atlas, sprite_t *sprite, unsigned num_frames);
+
+// Side of the square (user space) a frame covers when the sprite is `width` x `height`
+double sprite_atlas_get_frame_extent(double width, double height);
+
+// Draws `frame` of the sprite, scaled to `width` x `height`, centered on `center_x`, `center_y`.
+// All frames are rendered the first time (or when the size in device pixels changes).
+// Like sprite_prepare(), for every frame
+void sprite_atlas_prepare(sprite_atlas_t *atlas, cairo_t *cr, double width, double height);
+
+void sprite_atlas_paint(sprite_atlas_t *atlas, cairo_t *cr, double center_x, double center_y,
+                        double width, double height, unsigned frame, double alpha);
+
+void sprite_atlas_invalidate(sprite_atlas_t *atlas);
@@ -0,0 +1,329 @@
+/*
+ * text.c
+ *
+ * Strings shaped once and kept rasterized until they change
+ */
+
+#include "text.h"
+
+#include <math.h>
+#include <string.h>
+
+static bool text_rasterize(text_t *text, cairo_surface_t *target, double device_scale)
+{
+    text_invalidate(text);
+
+    const cairo_rectangle_int_t extents = text_get_extents(text);
+    const int pixel_width = (int)ceil(extents.width * device_scale);
+    const int pixel_height = (int)ceil(extents.height * device_scale);
+    if (pixel_width <= 0 || pixel_height <= 0) {
+        return false;
+    }
+
+    text->surface = cairo_surface_create_similar(target, CAIRO_CONTENT_COLOR_ALPHA, pixel_width, pixel_height);
+    if (cairo_surface_status(text->surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(text->surface);
+        text->surface = NULL;
+        return false;
+    }
+
+    cairo_t *cr = cairo_create(text->surface);
+    cairo_scale(cr, device_scale, device_scale);
+    cairo_translate(cr, -extents.x, -extents.y);
+    cairo_set_source_rgba(cr, text->color.r, text->color.g, text->color.b, text->color.a);
+    pango_cairo_show_layout(cr, text->layout);
+    cairo_destroy(cr);
+
+    text->surface_rect = extents;
+    text->device_scale = device_scale;
+
+    return true;
+}
+
+void text_init(text_t *text, cairo_t *cr, const PangoFontDescription *font, text_color_t color)
+{
+    *text = (text_t) { 0 };
+    text->layout = pango_cairo_create_layout(cr);
+    text->color = color;
+
+    pango_layout_set_font_description(text->layout, font);
+    pango_layout_set_text(text->layout, "", -1);
+    pango_layout_get_pixel_extents(text->layout, &text->ink_rect, &text->logical_rect);
+}
+
+void text_set_string(text_t *text, const char *string)
+{
+    if (strncmp(text->text, string, kMaxTextLength - 1) == 0) {
+        return;
+    }
+
+    strncpy(text->text, string, kMaxTextLength - 1);
+    text->text[kMaxTextLength - 1] = '\0';
+
+    pango_layout_set_text(text->layout, text->text, -1);
+    pango_layout_get_pixel_extents(text->layout, &text->ink_rect, &text->logical_rect);
+    text_invalidate(text);
+}
+
+cairo_rectangle_int_t text_get_extents(const text_t *text)
+{
+    // Italic glyphs can overhang the logical rect
+    const PangoRectangle *ink = &text->ink_rect;
+    const PangoRectangle *logical = &text->logical_rect;
+    const int x1 = MIN(ink->x, logical->x);
+    const int y1 = MIN(ink->y, logical->y);
+    const int x2 = MAX(ink->x + ink->width, logical->x + logical->width);
+    const int y2 = MAX(ink->y + ink->height, logical->y + logical->height);
+
+    return (cairo_rectangle_int_t) { x1, y1, x2 - x1, y2 - y1 };
+}
+
+static double get_device_scale(cairo_t *cr)
+{
+    double dx = 1.0, dy = 0.0;
+    cairo_user_to_device_distance(cr, &dx, &dy);
+    return hypot(dx, dy);
+}
+
+// Makes sure the text is rasterized for drawing on `cr`
+static bool text_update(text_t *text, cairo_t *cr, double *device_scale)
+{
+    *device_scale = get_device_scale(cr);
+    if (*device_scale <= 0.0) {
+        return false;
+    }
+
+    if (text->surface == NULL || text->device_scale != *device_scale) {
+        return text_rasterize(text, cairo_get_target(cr), *device_scale);
+    }
+
+    return true;
+}
+
+void text_prepare(text_t *text, cairo_t *cr)
+{
+    double device_scale;
+    text_update(text, cr, &device_scale);
+}
+
+void text_paint(text_t *text, cairo_t *cr, double x, double y, double alpha)
+{
+    double device_scale;
+    if (!text_update(text, cr, &device_scale)) {
+        return;
+    }
+
+    // Land on whole pixels, so the blit doesn't resample
+    const double origin_x = x + text->surface_rect.x;
+    const double origin_y = y + text->surface_rect.y;
+
+    cairo_save(cr);
+    cairo_translate(cr, round(origin_x * device_scale) / device_scale, round(origin_y * device_scale) / device_scale);
+    cairo_scale(cr, 1.0 / device_scale, 1.0 / device_scale);
+    cairo_set_source_surface(cr, text->surface, 0, 0);
+    cairo_paint_with_alpha(cr, alpha);
+    cairo_restore(cr);
+}
+
+void text_invalidate(text_t *text)
+{
+    if (text->surface != NULL) {
+        cairo_surface_destroy(text->surface);
+        text->surface = NULL;
+    }
+}
+
+void text_destroy(text_t *text)
+{
+    text_invalidate(text);
+
+    if (text->layout != NULL) {
+        g_object_unref(text->layout);
+        text->layout = NULL;
+    }
+}
+
+/* Glyph atlas */
+
+static int glyph_atlas_index(const glyph_atlas_t *atlas, char c)
+{
+    for (unsigned i = 0; i < atlas->num_chars; i++) {
+        if (atlas->chars[i] == c) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void glyph_atlas_init(glyph_atlas_t *atlas, cairo_t *cr, const PangoFontDescription *font,
+                      text_color_t color, const char *chars)
+{
+    *atlas = (glyph_atlas_t) { 0 };
+    atlas->layout = pango_cairo_create_layout(cr);
+    atlas->color = color;
+    pango_layout_set_font_description(atlas->layout, font);
+
+    strncpy(atlas->chars, chars, kGlyphAtlasMaxChars);
+    atlas->num_chars = strlen(atlas->chars);
+
+    int digit_advance = 0;
+    int x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+    PangoRectangle ink_rects[kGlyphAtlasMaxChars];
+    for (unsigned i = 0; i < atlas->num_chars; i++) {
+        PangoRectangle logical;
+        pango_layout_set_text(atlas->layout, &atlas->chars[i], 1);
+        pango_layout_get_pixel_extents(atlas->layout, &ink_rects[i], &logical);
+        atlas->advances[i] = logical.width;
+
+        if (atlas->chars[i] >= '0' && atlas->chars[i] <= '9') {
+            digit_advance = MAX(digit_advance, logical.width);
+        }
+
+        // Italic glyphs can overhang the logical rect
+        const PangoRectangle *ink = &ink_rects[i];
+        x1 = MIN(x1, MIN(ink->x, logical.x));
+        y1 = MIN(y1, MIN(ink->y, logical.y));
+        x2 = MAX(x2, MAX(ink->x + ink->width, logical.x + logical.width));
+        y2 = MAX(y2, MAX(ink->y + ink->height, logical.y + logical.height));
+    }
+
+    for (unsigned i = 0; i < atlas->num_chars; i++) {
+        if (atlas->chars[i] >= '0' && atlas->chars[i] <= '9') {
+            atlas->glyph_offsets[i] = (digit_advance - atlas->advances[i]) / 2;
+            atlas->advances[i] = digit_advance;
+        }
+
+        x2 = MAX(x2, atlas->glyph_offsets[i] + ink_rects[i].x + ink_rects[i].width);
+    }
+
+    atlas->cell_rect = (cairo_rectangle_int_t) { x1, y1, x2 - x1, y2 - y1 };
+}
+
+int glyph_atlas_get_offset(const glyph_atlas_t *atlas, const char *string, unsigned index)
+{
+    int offset = 0;
+    for (unsigned i = 0; i < index && string[i] != '\0'; i++) {
+        const int glyph = glyph_atlas_index(atlas, string[i]);
+        offset += (glyph >= 0) ? atlas->advances[glyph] : 0;
+    }
+
+    return offset;
+}
+
+cairo_rectangle_t glyph_atlas_get_cell(const glyph_atlas_t *atlas, const char *string, unsigned index, double x, double y)
+{
+    const cairo_rectangle_int_t cell = atlas->cell_rect;
+    return (cairo_rectangle_t) {
+        x + glyph_atlas_get_offset(atlas, string, index) + cell.x,
+        y + cell.y,
+        cell.width,
+        cell.height,
+    };
+}
+
+static bool glyph_atlas_rasterize(glyph_atlas_t *atlas, cairo_surface_t *target, double device_scale)
+{
+    glyph_atlas_invalidate(atlas);
+
+    const cairo_rectangle_int_t cell = atlas->cell_rect;
+    const int cell_pixel_width = (int)ceil(cell.width * device_scale);
+    const int cell_pixel_height = (int)ceil(cell.height * device_scale);
+    if (cell_pixel_width <= 0 || cell_pixel_height <= 0 || atlas->num_chars == 0) {
+        return false;
+    }
+
+    atlas->surface = cairo_surface_create_similar(target, CAIRO_CONTENT_COLOR_ALPHA,
+                                                  cell_pixel_width * atlas->num_chars, cell_pixel_height);
+    if (cairo_surface_status(atlas->surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(atlas->surface);
+        atlas->surface = NULL;
+        return false;
+    }
+
+    cairo_t *cr = cairo_create(atlas->surface);
+    cairo_set_source_rgba(cr, atlas->color.r, atlas->color.g, atlas->color.b, atlas->color.a);
+    for (unsigned i = 0; i < atlas->num_chars; i++) {
+        cairo_save(cr);
+        cairo_rectangle(cr, i * cell_pixel_width, 0, cell_pixel_width, cell_pixel_height);
+        cairo_clip(cr);
+        cairo_translate(cr, i * cell_pixel_width, 0);
+        cairo_scale(cr, device_scale, device_scale);
+        cairo_translate(cr, atlas->glyph_offsets[i] - cell.x, -cell.y);
+
+        pango_layout_set_text(atlas->layout, &atlas->chars[i], 1);
+        pango_cairo_show_layout(cr, atlas->layout);
+        cairo_restore(cr);
+    }
+    cairo_destroy(cr);
+
+    atlas->cell_pixel_width = cell_pixel_width;
+    atlas->cell_pixel_height = cell_pixel_height;
+    atlas->device_scale = device_scale;
+
+    return true;
+}
+
+static bool glyph_atlas_update(glyph_atlas_t *atlas, cairo_t *cr, double *device_scale)
+{
+    *device_scale = get_device_scale(cr);
+    if (*device_scale <= 0.0) {
+        return false;
+    }
+
+    if (atlas->surface == NULL || atlas->device_scale != *device_scale) {
+        return glyph_atlas_rasterize(atlas, cairo_get_target(cr), *device_scale);
+    }
+
+    return true;
+}
+
+void glyph_atlas_prepare(glyph_atlas_t *atlas, cairo_t *cr)
+{
+    double device_scale;
+    glyph_atlas_update(atlas, cr, &device_scale);
+}
+
+void glyph_atlas_paint(glyph_atlas_t *atlas, cairo_t *cr, char c, double x, double y, double alpha)
+{
+    const int glyph = glyph_atlas_index(atlas, c);
+    if (glyph < 0) {
+        return;
+    }
+
+    double device_scale;
+    if (!glyph_atlas_update(atlas, cr, &device_scale)) {
+        return;
+    }
+
+    // Land on whole pixels, so the blit doesn't resample
+    const double origin_x = x + atlas->cell_rect.x;
+    const double origin_y = y + atlas->cell_rect.y;
+
+    cairo_save(cr);
+    cairo_translate(cr, round(origin_x * device_scale) / device_scale, round(origin_y * device_scale) / device_scale);
+    cairo_scale(cr, 1.0 / device_scale, 1.0 / device_scale);
+    cairo_rectangle(cr, 0, 0, atlas->cell_pixel_width, atlas->cell_pixel_height);
+    cairo_clip(cr);
+    cairo_set_source_surface(cr, atlas->surface, -glyph * atlas->cell_pixel_width, 0);
+    cairo_paint_with_alpha(cr, alpha);
+    cairo_restore(cr);
+}
+
+void glyph_atlas_invalidate(glyph_atlas_t *atlas)
+{
+    if (atlas->surface != NULL) {
+        cairo_surface_destroy(atlas->surface);
+        atlas->surface = NULL;
+    }
+}
+
+void glyph_atlas_destroy(glyph_atlas_t *atlas)
+{
+    glyph_atlas_invalidate(atlas);
+
+    if (atlas->layout != NULL) {
+        g_object_unref(atlas->layout);
+        atlas->layout = NULL;
+    }
+}
@@ -0,0 +1,104 @@
+/*
+ * text.h
+ *
+ * Strings shaped once and kept rasterized until they change
+ */
+
+#pragma once
+
+#include <cairo/cairo.h>
+#include <pango/pangocairo.h>
+#include <stdbool.h>
+
+#define kMaxTextLength 128
+
+typedef struct {
+    double r, g, b, a;
+} text_color_t;
+
+typedef struct {
+    // Dedicated to this string, so its font never changes and Pango's caches stay warm.
+    PangoLayout            *layout;
+
+    char                    text[kMaxTextLength];
+    text_color_t            color;
+
+    // In pixels, relative to the layout's origin
+    PangoRectangle          ink_rect;
+    PangoRectangle          logical_rect;
+
+    // Rasterized covering both rects above, at `device_scale` pixels per unit
+    cairo_surface_t        *surface;
+    cairo_rectangle_int_t   surface_rect;
+    double                  device_scale;
+} text_t;
+
+// `cr` provides the font options the text is shaped with.
+void text_init(text_t *text, cairo_t *cr, const PangoFontDescription *font, text_color_t color);
+
+// Does nothing (and keeps the cached rendering) if `string` hasn't changed.
+void text_set_string(text_t *text, const char *string);
+
+// Union of the ink and logical rects; everything drawing the text can touch.
+cairo_rectangle_int_t text_get_extents(const text_t *text);
+
+// Rasterizes the text for drawing on `cr`, without drawing it. Painting it there afterwards
+// only reads the text, so several threads can share it.
+void text_prepare(text_t *text, cairo_t *cr);
+
+// Draws the text with the layout's origin at `x`, `y`
+void text_paint(text_t *text, cairo_t *cr, double x, double y, double alpha);
+
+// Drops the rasterized copy. Call when the output changes size or scale.
+void text_invalidate(text_t *text);
+
+// Frees the rasterized copy and the layout
+void text_destroy(text_t *text);
+
+#define kGlyphAtlasMaxChars 16
+
+// Every glyph of a small, fixed set of characters (like a clock's), rasterized once, so strings
+// made of them can be put together (and updated) a character at a time.
+typedef struct {
+    PangoLayout            *layout;
+    text_color_t            color;
+
+    char                    chars[kGlyphAtlasMaxChars + 1];
+    unsigned                num_chars;
+
+    // Digits all advance as far as the widest one (centered within that), so a string's
+    // layout doesn't change along with its digits.
+    int                     advances[kGlyphAtlasMaxChars];
+    int                     glyph_offsets[kGlyphAtlasMaxChars];
+
+    // Covers every glyph, relative to its origin
+    cairo_rectangle_int_t   cell_rect;
+
+    // One cell per character, side by side, at `device_scale` pixels per unit
+    cairo_surface_t        *surface;
+    int                     cell_pixel_width;
+    int                     cell_pixel_height;
+    double                  device_scale;
+} glyph_atlas_t;
+
+// `cr` provides the font options the glyphs are shaped with.
+void glyph_atlas_init(glyph_atlas_t *atlas, cairo_t *cr, const PangoFontDescription *font,
+                      text_color_t color, const char *chars);
+
+// Distance from the string's origin to the origin of character `index`. Characters that
+// aren't in the atlas take up no space.
+int glyph_atlas_get_offset(const glyph_atlas_t *atlas, const char *string, unsigned index);
+
+// Where character `index` of `string` (with its origin at `x`, `y`) can draw
+cairo_rectangle_t glyph_atlas_get_cell(const glyph_atlas_t *atlas, const char *string, unsigned index, double x, double y);
+
+// Like text_prepare(), for every glyph
+void glyph_atlas_prepare(glyph_atlas_t *atlas, cairo_t *cr);
+
+// Draws `c` with its origin at `x`, `y`. Rasterizes every glyph the first time (or when the
+// size in device pixels changes).
+void glyph_atlas_paint(glyph_atlas_t *atlas, cairo_t *cr, char c, double x, double y, double alpha);
+
+void glyph_atlas_invalidate(glyph_atlas_t *atlas);
+
+void glyph_atlas_destroy(glyph_atlas_t *atlas);
@@ -0,0 +1,183 @@
+/*
+ * timer.c
+ *
+ * One-shot timers for the runloop, ordered by deadline
+ */
+
+#include "timer.h"
+
+#include <stdio.h>
+
+#define kTimerSlotBits 8
+#define kTimerSlotMask ((1 << kTimerSlotBits) - 1)
+#define kTimerNotQueued kMaxTimers
+
+static inline timer_id make_timer_id(unsigned slot, unsigned generation)
+{
+    return (generation << kTimerSlotBits) | slot;
+}
+
+static saver_timer_t* timer_for_id(timer_queue_t *queue, timer_id timer)
+{
+    const unsigned slot = (timer & kTimerSlotMask);
+    if (timer == TIMER_ID_INVALID || slot >= kMaxTimers) {
+        return NULL;
+    }
+
+    saver_timer_t *t = &queue->slots[slot];
+    if (!t->allocated || t->generation != (timer >> kTimerSlotBits)) {
+        return NULL;
+    }
+
+    return t;
+}
+
+/*
+ * Heap maintenance
+ */
+
+static inline bool heap_earlier(timer_queue_t *queue, unsigned a, unsigned b)
+{
+    return queue->slots[queue->heap[a]].exec_time < queue->slots[queue->heap[b]].exec_time;
+}
+
+static void heap_swap(timer_queue_t *queue, unsigned a, unsigned b)
+{
+    unsigned tmp = queue->heap[a];
+    queue->heap[a] = queue->heap[b];
+    queue->heap[b] = tmp;
+
+    queue->slots[queue->heap[a]].heap_index = a;
+    queue->slots[queue->heap[b]].heap_index = b;
+}
+
+static void heap_sift_up(timer_queue_t *queue, unsigned idx)
+{
+    while (idx > 0) {
+        unsigned parent = (idx - 1) / 2;
+        if (!heap_earlier(queue, idx, parent)) break;
+
+        heap_swap(queue, idx, parent);
+        idx = parent;
+    }
+}
+
+static void heap_sift_down(timer_queue_t *queue, unsigned idx)
+{
+    for (;;) {
+        unsigned left = (idx * 2) + 1;
+        unsigned right = left + 1;
+        unsigned earliest = idx;
+
+        if (left < queue->num_queued && heap_earlier(queue, left, earliest)) earliest = left;
+        if (right < queue->num_queued && heap_earlier(queue, right, earliest)) earliest = right;
+        if (earliest == idx) break;
+
+        heap_swap(queue, idx, earliest);
+        idx = earliest;
+    }
+}
+
+static void heap_insert(timer_queue_t *queue, unsigned slot)
+{
+    unsigned idx = queue->num_queued++;
+    queue->heap[idx] = slot;
+    queue->slots[slot].heap_index = idx;
+    heap_sift_up(queue, idx);
+}
+
+static void heap_remove(timer_queue_t *queue, unsigned idx)
+{
+    queue->slots[queue->heap[idx]].heap_index = kTimerNotQueued;
+
+    unsigned last = --queue->num_queued;
+    if (idx != last) {
+        queue->heap[idx] = queue->heap[last];
+        queue->slots[queue->heap[idx]].heap_index = idx;
+
+        heap_sift_up(queue, idx);
+        heap_sift_down(queue, queue->slots[queue->heap[idx]].heap_index);
+    }
+}
+
+/*
+ * Public interface
+ */
+
+timer_id timer_schedule(timer_queue_t *queue, anim_time_interval_t exec_time, timer_callback_t callback, void *context)
+{
+    for (unsigned slot = 0; slot < kMaxTimers; slot++) {
+        saver_timer_t *t = &queue->slots[slot];
+        if (t->allocated) continue;
+
+        t->allocated = true;
+        t->generation++;
+        t->exec_time = exec_time;
+        t->callback = callback;
+        t->context = context;
+        heap_insert(queue, slot);
+
+        return make_timer_id(slot, t->generation);
+    }
+
+    fprintf(stderr, "WARNING: Out of timer slots, dropping timer\n");
+    return TIMER_ID_INVALID;
+}
+
+bool timer_reschedule(timer_queue_t *queue, timer_id timer, anim_time_interval_t exec_time)
+{
+    saver_timer_t *t = timer_for_id(queue, timer);
+    if (t == NULL) {
+        return false;
+    }
+
+    t->exec_time = exec_time;
+    if (t->heap_index == kTimerNotQueued) {
+        // Currently firing; re-arm it.
+        heap_insert(queue, timer & kTimerSlotMask);
+    } else {
+        heap_sift_up(queue, t->heap_index);
+        heap_sift_down(queue, t->heap_index);
+    }
+
+    return true;
+}
+
+void timer_cancel(timer_queue_t *queue, timer_id timer)
+{
+    saver_timer_t *t = timer_for_id(queue, timer);
+    if (t == NULL) {
+        return;
+    }
+
+    if (t->heap_index != kTimerNotQueued) {
+        heap_remove(queue, t->heap_index);
+    }
+
+    t->allocated = false;
+}
+
+anim_time_interval_t timer_next_deadline(timer_queue_t *queue)
+{
+    if (queue->num_queued == 0) {
+        return ANIM_TIME_NEVER;
+    }
+
+    return queue->slots[queue->heap[0]].exec_time;
+}
+
+void timer_fire_expired(timer_queue_t *queue, anim_time_interval_t now)
+{
+    while (queue->num_queued > 0) {
+        saver_timer_t *t = &queue->slots[queue->heap[0]];
+        if (t->exec_time > now) break;
+
+        heap_remove(queue, 0);
+        t->callback(t->context);
+
+        // One-shot, unless the callback re-armed it with timer_reschedule().
+        if (t->heap_index == kTimerNotQueued) {
+            t->allocated = false;
+        }
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * timer.h
+ *
+ * One-shot timers for the runloop, ordered by deadline
+ */
+
+#pragma once
+
+#include "animation.h"
+
+#include <stdbool.h>
+
+#define kMaxTimers 16
+
+// Timer IDs stay valid until the timer fires or is cancelled, and are never
+// reused for a different timer, so holding on to a stale one is harmless.
+typedef unsigned int timer_id;
+#define TIMER_ID_INVALID 0
+
+typedef void (*timer_callback_t)(void *context);
+
+typedef struct {
+    bool                    allocated;
+    unsigned                generation;
+    unsigned                heap_index;
+
+    anim_time_interval_t    exec_time;
+    timer_callback_t        callback;
+    void                   *context;
+} saver_timer_t;
+
+typedef struct {
+    saver_timer_t           slots[kMaxTimers];
+
+    // Min-heap of slot indices, ordered by exec_time
+    unsigned                heap[kMaxTimers];
+    unsigned                num_queued;
+} timer_queue_t;
+
+// Schedule `callback` to run at `exec_time`. Returns TIMER_ID_INVALID if the queue is full.
+timer_id timer_schedule(timer_queue_t *queue, anim_time_interval_t exec_time, timer_callback_t callback, void *context);
+
+// Move a pending timer to `exec_time`. Calling this from a timer's own callback re-arms it.
+// Returns false if `timer` has already fired or been cancelled.
+bool timer_reschedule(timer_queue_t *queue, timer_id timer, anim_time_interval_t exec_time);
+
+// Cancel a pending timer. Does nothing if it has already fired.
+void timer_cancel(timer_queue_t *queue, timer_id timer);
+
+// Returns the deadline of the next timer to fire (ANIM_TIME_NEVER if there are none)
+anim_time_interval_t timer_next_deadline(timer_queue_t *queue);
+
+// Run the callbacks of all timers whose deadline is at or before `now`, in order
+void timer_fire_expired(timer_queue_t *queue, anim_time_interval_t now);
@@ -8,6 +8,7 @@
 #include "display_server.h"
 #include "render.h"
 #include "events.h"
+#include "fill.h"
 
 #include <cairo/cairo.h>
 #include <poll.h>
@@ -17,7 +18,9 @@
 
 #ifdef HAVE_WAYLAND
 #include <linux/memfd.h>
+#include <math.h>
 #include <sys/mman.h>
+#include <sys/param.h>
 #include <sys/syscall.h>
 #include <wayland-client.h>
 #include <unistd.h>
@@ -25,6 +28,11 @@
 
 // This is generated at build time. 
 #include "ext-session-lock-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+
+#ifdef HAVE_FRACTIONAL_SCALE
+#include "fractional-scale-v1-client-protocol.h"
+#endif
 
 #endif
 
@@ -40,8 +48,12 @@ typedef struct {
 // Forward declarations
 static bool wayland_init(void);
 static cairo_surface_t* wayland_acquire_surface(void);
-static void wayland_get_display_bounds(unsigned int monitor_num, display_bounds_t *bounds);
+static unsigned int wayland_get_num_views(void);
+static void wayland_get_view_bounds(unsigned int view, display_bounds_t *bounds);
 static void wayland_poll_events(void *state);
+static int wayland_get_poll_fds(struct pollfd *fds, int max_fds);
+static anim_time_interval_t wayland_next_frame_time(unsigned int view);
+static unsigned int wayland_begin_frame(unsigned int view, display_plane_t *planes);
 static void wayland_destroy_surface(cairo_surface_t *surface);
 static void wayland_cleanup(void);
 
@@ -51,32 +63,166 @@ static void wayland_cleanup(void);
 static struct wl_display *display = NULL;
 static struct wl_registry *registry = NULL;
 static struct wl_compositor *compositor = NULL;
+static struct wl_subcompositor *subcompositor = NULL;
 static struct wl_shm *shm = NULL;
-static struct wl_surface *surface = NULL;
 static struct wl_seat *seat = NULL;
 static struct wl_keyboard *keyboard = NULL;
-static struct wl_output *output = NULL;
 static keyboard_state_t keyboard_state = { 0 };
 
 // Session lock globals
 static struct ext_session_lock_manager_v1 *session_lock_manager = NULL;
 static struct ext_session_lock_v1 *session_lock = NULL;
-static struct ext_session_lock_surface_v1 *lock_surface = NULL;
 
-// Surface and buffer management
-static struct wl_buffer *buffer = NULL;
-static void *shm_data = NULL;
-static int shm_size = 0;
-static int surface_width = 1920;  // Default, will be updated
-static int surface_height = 1080; // Default, will be updated
-static bool surface_configured = false;
-static cairo_surface_t *current_cairo_surface = NULL;
+// Viewports map buffers onto their surface's logical size: a single pixel stretched over the
+// whole output for the background, or a fractionally scaled buffer back down.
+static struct wp_viewporter *viewporter = NULL;
+
+#ifdef HAVE_FRACTIONAL_SCALE
+// Fractional scaling: the compositor tells us each surface's preferred scale, and we draw
+// at that many pixels.
+static struct wp_fractional_scale_manager_v1 *fractional_scale_manager = NULL;
+#endif
+
+// We draw into one buffer while the compositor may still be reading another
+#define kSwapchainLength 3
+
+typedef struct {
+    struct wl_buffer   *wl_buffer;
+    cairo_surface_t    *cairo_surface;
+
+    // Held by the compositor from commit until it sends wl_buffer.release
+    bool                busy;
+
+    // Everything committed (from other buffers) since this one was last drawn
+    cairo_region_t     *stale_region;
+} swapchain_buffer_t;
+
+// Frame pacing
+// If the compositor stops sending frame callbacks (e.g., the output is off), keep
+// ticking at this interval so animations (and unlocking) still complete.
+static const anim_time_interval_t kFrameCallbackTimeout = 0.25;
+
+static const char *kPixelFormatEnvVar = "BUZZLOCKER_PIXEL_FORMAT";
+
+// What the planes' buffers hold. Everything on the lock surface is opaque, so by default there's
+// no alpha channel for the compositor to blend. RGB565 halves the memory and bandwidth again, at
+// the cost of some banding in the gradients.
+typedef struct {
+    const char         *name;
+    enum wl_shm_format  wl_format;
+    cairo_format_t      cairo_format;
+    int                 bytes_per_pixel;
+} buffer_format_t;
+
+static const buffer_format_t kBufferFormats[] = {
+    { "xrgb8888", WL_SHM_FORMAT_XRGB8888, CAIRO_FORMAT_RGB24, 4 },
+    { "argb8888", WL_SHM_FORMAT_ARGB8888, CAIRO_FORMAT_ARGB32, 4 },
+    { "rgb565", WL_SHM_FORMAT_RGB565, CAIRO_FORMAT_RGB16_565, 2 },
+};
+
+// One part of a view's canvas, with its own buffers. With subsurfaces, each plane is shown
+// on its own surface over a single-pixel background, so only the parts of the canvas with
+// anything on them get drawn, uploaded and composited. Otherwise there's just the one plane,
+// covering everything, on the lock surface itself.
+typedef struct {
+    cairo_rectangle_int_t   rect;           // In buffer pixels of the whole canvas
+    cairo_rectangle_int_t   logical_rect;   // Where it sits on the lock surface
+
+    swapchain_buffer_t      swapchain[kSwapchainLength];
+    swapchain_buffer_t     *front_buffer;   // Last committed
+    swapchain_buffer_t     *back_buffer;    // Currently being drawn into
+    void                   *shm_data;
+    size_t                  shm_size;
+} lock_plane_t;
+
+// Buffers shared by every output of the same size and scale. The same wl_buffer gets
+// attached to each of their surfaces, so it's only drawn (and kept in memory) once.
+typedef struct {
+    bool                    in_use;
+    int                     width;          // In buffer pixels
+    int                     height;
+    double                  scale;          // Buffer pixels per logical pixel
+    int                     logical_width;
+    int                     logical_height;
+
+    lock_plane_t            planes[kMaxPlanes];
+    unsigned int            num_planes;
+
+    struct wl_callback     *frame_callback;
+    anim_time_interval_t    last_commit_time;
+} lock_view_t;
+
+#define kMaxOutputs 16
+
+// A plane's surface on one output
+typedef struct {
+    struct wl_surface                   *surface;
+    struct wl_subsurface                *subsurface;
+    struct wp_viewport                  *viewport;
+} output_plane_t;
+
+typedef struct {
+    bool                                 in_use;
+    uint32_t                             registry_name;
+    struct wl_output                    *wl_output;
+    struct wl_surface                   *surface;
+    struct ext_session_lock_surface_v1  *lock_surface;
+
+    int                                  width;     // Logical size, from the lock surface's configure
+    int                                  height;
+    bool                                 configured;
+    int                                  view;  // -1 until configured
+
+    // From wl_output.scale, applied on wl_output.done
+    int32_t                              integer_scale;
+    int32_t                              pending_integer_scale;
+
+    struct wp_viewport                  *viewport;
+
+#ifdef HAVE_FRACTIONAL_SCALE
+    struct wp_fractional_scale_v1       *fractional_scale;
+    uint32_t                             preferred_scale;   // In 120ths, 0 until the compositor says
+#endif
+
+    // Subsurfaces for the view's planes (none if the planes go on the lock surface)
+    output_plane_t                       planes[kMaxPlanes];
+    unsigned int                         num_planes;
+
+    // Background color last attached to the lock surface, 0 if none
+    uint32_t                             background_pixel;
+
+    // Joined a view whose buffers were already drawn, so the next commit has to damage all of it
+    bool                                 needs_full_damage;
+} lock_output_t;
+
+static lock_view_t views[kMaxViews] = { 0 };
+static lock_output_t outputs[kMaxOutputs] = { 0 };
+
+// Single-pixel buffers for the background, one per color still on screen. The compositor
+// usually lets go of the old one as soon as it's replaced, so a few go a long way.
+#define kBackgroundBufferCount 8
+
+typedef struct {
+    struct wl_buffer   *wl_buffer;
+    uint32_t           *pixel;
+    bool                busy;
+} background_buffer_t;
+
+static background_buffer_t background_buffers[kBackgroundBufferCount] = { 0 };
+static void *background_shm_data = NULL;
+static uint32_t background_pixel = 0xff000000;
+
+// Which of kBufferFormats wl_shm supports (by index), and the one in use
+static uint32_t supported_buffer_formats = 0;
+static const buffer_format_t *buffer_format = &kBufferFormats[0];
 
 // Evidently glibc does not provide a wrapper for this syscall.
 static inline int memfd_create(const char *name, unsigned int flags) {
     return syscall(__NR_memfd_create, name, flags);
 }
 
+static void destroy_swapchain(lock_plane_t *plane);
+
 // Session lock listeners
 static bool session_is_locked = false;
 
@@ -99,16 +245,110 @@ static const struct ext_session_lock_v1_listener session_lock_listener = {
     .finished = session_lock_finished,
 };
 
-// Lock surface listeners  
-static void lock_surface_configure(void *data, struct ext_session_lock_surface_v1 *lock_surface, 
-                                   uint32_t serial, uint32_t width, uint32_t height)
+// Views
+static bool use_subsurfaces(void)
 {
-    surface_width = width;
-    surface_height = height;
-    surface_configured = true;
-    
-    ext_session_lock_surface_v1_ack_configure(lock_surface, serial);
+    // The background buffer has to be stretched over the whole output
+    return (subcompositor != NULL && viewporter != NULL);
+}
+
+static void layout_view_planes(lock_view_t *view)
+{
+    cairo_rectangle_int_t logical_rects[kMaxPlanes];
+    unsigned int num_planes = 0;
+    if (use_subsurfaces()) {
+        num_planes = get_content_rects(view->logical_width, view->logical_height, logical_rects, kMaxPlanes);
+    }
+
+    if (num_planes == 0) {
+        logical_rects[0] = (cairo_rectangle_int_t) { 0, 0, view->logical_width, view->logical_height };
+        num_planes = 1;
+    }
+
+    // Rounding each edge (rather than the size) keeps neighboring planes from overlapping
+    for (unsigned i = 0; i < num_planes; i++) {
+        const cairo_rectangle_int_t logical = logical_rects[i];
+        const int x1 = MIN(view->width, (int)lround(logical.x * view->scale));
+        const int y1 = MIN(view->height, (int)lround(logical.y * view->scale));
+        const int x2 = MIN(view->width, (int)lround((logical.x + logical.width) * view->scale));
+        const int y2 = MIN(view->height, (int)lround((logical.y + logical.height) * view->scale));
+
+        view->planes[i] = (lock_plane_t) {
+            .rect = { x1, y1, MAX(1, x2 - x1), MAX(1, y2 - y1) },
+            .logical_rect = logical,
+        };
+    }
+
+    view->num_planes = num_planes;
+}
+
+static int view_for_size(int width, int height, double scale, int logical_width, int logical_height)
+{
+    int free_slot = -1;
+    for (int i = 0; i < kMaxViews; i++) {
+        if (views[i].in_use && views[i].width == width && views[i].height == height && views[i].scale == scale) {
+            return i;
+        }
+
+        if (!views[i].in_use && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+
+    if (free_slot >= 0) {
+        // Buffers get allocated on its first frame
+        views[free_slot] = (lock_view_t) {
+            .in_use = true,
+            .width = width,
+            .height = height,
+            .scale = scale,
+            .logical_width = logical_width,
+            .logical_height = logical_height,
+        };
+
+        layout_view_planes(&views[free_slot]);
+    }
 
+    return free_slot;
+}
+
+static void release_view_if_unused(int view_idx)
+{
+    if (view_idx < 0) {
+        return;
+    }
+
+    for (unsigned i = 0; i < kMaxOutputs; i++) {
+        if (outputs[i].in_use && outputs[i].view == view_idx) {
+            return;
+        }
+    }
+
+    lock_view_t *view = &views[view_idx];
+    if (view->frame_callback) {
+        wl_callback_destroy(view->frame_callback);
+    }
+
+    for (unsigned i = 0; i < view->num_planes; i++) {
+        destroy_swapchain(&view->planes[i]);
+    }
+
+    *view = (lock_view_t) { 0 };
+}
+
+static double output_scale(const lock_output_t *output)
+{
+#ifdef HAVE_FRACTIONAL_SCALE
+    if (output->fractional_scale && output->preferred_scale > 0) {
+        return output->preferred_scale / 120.0;
+    }
+#endif
+
+    return output->integer_scale;
+}
+
+static void queue_size_changed_event(void)
+{
     event_t resize_event = (event_t) {
         .type = EVENT_SURFACE_SIZE_CHANGED,
     };
@@ -116,10 +356,268 @@ static void lock_surface_configure(void *data, struct ext_session_lock_surface_v
     queue_event(resize_event);
 }
 
+// Moves the output over to the view for its current size and scale. Returns false if it already fit.
+static bool update_output_view(lock_output_t *output)
+{
+    if (!output->configured) {
+        return false;
+    }
+
+    // Buffers are allocated at device resolution, so the compositor never has to upscale them.
+    const double scale = output_scale(output);
+    const int pixel_width = (int)lround(output->width * scale);
+    const int pixel_height = (int)lround(output->height * scale);
+
+    const int old_view = output->view;
+    const bool view_fits = (old_view >= 0 && views[old_view].width == pixel_width
+                            && views[old_view].height == pixel_height && views[old_view].scale == scale);
+    if (view_fits) {
+        return false;
+    }
+
+    output->view = view_for_size(pixel_width, pixel_height, scale, output->width, output->height);
+    output->needs_full_damage = true;
+    release_view_if_unused(old_view);
+
+    if (output->view < 0) {
+        fprintf(stderr, "Too many different output sizes, output will stay blank\n");
+    }
+
+    return true;
+}
+
+// Double-buffered surface state telling the compositor how the buffer maps onto the output.
+// Goes out with the next commit.
+static void apply_output_scale(lock_output_t *output)
+{
+    if (output->viewport) {
+        wp_viewport_set_destination(output->viewport, output->width, output->height);
+        return;
+    }
+
+    wl_surface_set_buffer_scale(output->surface, output->integer_scale);
+}
+
+static void set_opaque(struct wl_surface *surface, int width, int height)
+{
+    struct wl_region *region = wl_compositor_create_region(compositor);
+    wl_region_add(region, 0, 0, width, height);
+    wl_surface_set_opaque_region(surface, region);
+    wl_region_destroy(region);
+}
+
+static void destroy_output_plane(output_plane_t *plane)
+{
+    if (plane->viewport) wp_viewport_destroy(plane->viewport);
+    if (plane->subsurface) wl_subsurface_destroy(plane->subsurface);
+    if (plane->surface) wl_surface_destroy(plane->surface);
+    *plane = (output_plane_t) { 0 };
+}
+
+// Lays the output's subsurfaces out like its view's planes. Goes out with the next commit
+// of the lock surface.
+static void update_output_planes(lock_output_t *output, const lock_view_t *view)
+{
+    // Whether it's the background or the one plane, nothing on the lock surface shows through
+    set_opaque(output->surface, output->width, output->height);
+
+    if (!use_subsurfaces()) {
+        return;
+    }
+
+    while (output->num_planes > view->num_planes) {
+        destroy_output_plane(&output->planes[--output->num_planes]);
+    }
+
+    while (output->num_planes < view->num_planes) {
+        output_plane_t *plane = &output->planes[output->num_planes++];
+        plane->surface = wl_compositor_create_surface(compositor);
+        plane->subsurface = wl_subcompositor_get_subsurface(subcompositor, plane->surface, output->surface);
+        plane->viewport = wp_viewporter_get_viewport(viewporter, plane->surface);
+    }
+
+    for (unsigned i = 0; i < view->num_planes; i++) {
+        const cairo_rectangle_int_t logical = view->planes[i].logical_rect;
+        wl_subsurface_set_position(output->planes[i].subsurface, logical.x, logical.y);
+        wp_viewport_set_destination(output->planes[i].viewport, logical.width, logical.height);
+        set_opaque(output->planes[i].surface, logical.width, logical.height);
+    }
+}
+
+// The surface plane `index` of the output's view is shown on
+static struct wl_surface* output_plane_surface(lock_output_t *output, unsigned int index)
+{
+    return (index < output->num_planes) ? output->planes[index].surface : output->surface;
+}
+
+// Lock surface listeners  
+static void lock_surface_configure(void *data, struct ext_session_lock_surface_v1 *lock_surface, 
+                                   uint32_t serial, uint32_t width, uint32_t height)
+{
+    lock_output_t *output = (lock_output_t *)data;
+    output->width = width;
+    output->height = height;
+    output->configured = true;
+    
+    ext_session_lock_surface_v1_ack_configure(lock_surface, serial);
+
+    update_output_view(output);
+    queue_size_changed_event();
+}
+
 static const struct ext_session_lock_surface_v1_listener lock_surface_listener = {
     .configure = lock_surface_configure,
 };
 
+#ifdef HAVE_FRACTIONAL_SCALE
+static void fractional_scale_preferred_scale(void *data, struct wp_fractional_scale_v1 *fractional_scale, uint32_t scale)
+{
+    lock_output_t *output = (lock_output_t *)data;
+    output->preferred_scale = scale;
+
+    if (update_output_view(output)) {
+        queue_size_changed_event();
+    }
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+    .preferred_scale = fractional_scale_preferred_scale,
+};
+#endif
+
+// Output listeners
+static void output_geometry(void *data, struct wl_output *wl_output, int32_t x, int32_t y,
+                            int32_t physical_width, int32_t physical_height, int32_t subpixel,
+                            const char *make, const char *model, int32_t transform)
+{
+    // Ignore
+}
+
+static void output_mode(void *data, struct wl_output *wl_output, uint32_t flags, int32_t width, int32_t height, int32_t refresh)
+{
+    // Ignore; the lock surface's configure has the size we draw at
+}
+
+static void output_scale_event(void *data, struct wl_output *wl_output, int32_t factor)
+{
+    lock_output_t *output = (lock_output_t *)data;
+    output->pending_integer_scale = factor;
+}
+
+static void output_done(void *data, struct wl_output *wl_output)
+{
+    lock_output_t *output = (lock_output_t *)data;
+    if (output->pending_integer_scale == output->integer_scale) {
+        return;
+    }
+
+    output->integer_scale = output->pending_integer_scale;
+    if (update_output_view(output)) {
+        queue_size_changed_event();
+    }
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_geometry,
+    .mode = output_mode,
+    .done = output_done,
+    .scale = output_scale_event,
+};
+
+// Outputs
+static void create_lock_surface(lock_output_t *output)
+{
+    output->surface = wl_compositor_create_surface(compositor);
+    output->lock_surface = ext_session_lock_v1_get_lock_surface(session_lock, output->surface, output->wl_output);
+    ext_session_lock_surface_v1_add_listener(output->lock_surface, &lock_surface_listener, output);
+
+    if (viewporter) {
+        output->viewport = wp_viewporter_get_viewport(viewporter, output->surface);
+    }
+
+#ifdef HAVE_FRACTIONAL_SCALE
+    if (fractional_scale_manager && output->viewport) {
+        output->fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(fractional_scale_manager, output->surface);
+        wp_fractional_scale_v1_add_listener(output->fractional_scale, &fractional_scale_listener, output);
+    }
+#endif
+}
+
+static void destroy_lock_surface(lock_output_t *output)
+{
+    while (output->num_planes > 0) {
+        destroy_output_plane(&output->planes[--output->num_planes]);
+    }
+
+    output->background_pixel = 0;
+
+#ifdef HAVE_FRACTIONAL_SCALE
+    if (output->fractional_scale) {
+        wp_fractional_scale_v1_destroy(output->fractional_scale);
+        output->fractional_scale = NULL;
+    }
+
+    output->preferred_scale = 0;
+#endif
+
+    if (output->viewport) {
+        wp_viewport_destroy(output->viewport);
+        output->viewport = NULL;
+    }
+
+    if (output->lock_surface) {
+        ext_session_lock_surface_v1_destroy(output->lock_surface);
+        output->lock_surface = NULL;
+    }
+
+    if (output->surface) {
+        wl_surface_destroy(output->surface);
+        output->surface = NULL;
+    }
+
+    const int view = output->view;
+    output->view = -1;
+    output->configured = false;
+    release_view_if_unused(view);
+}
+
+static void add_output(uint32_t registry_name, struct wl_output *wl_output)
+{
+    for (unsigned i = 0; i < kMaxOutputs; i++) {
+        lock_output_t *output = &outputs[i];
+        if (output->in_use) continue;
+
+        *output = (lock_output_t) {
+            .in_use = true,
+            .registry_name = registry_name,
+            .wl_output = wl_output,
+            .view = -1,
+            .integer_scale = 1,
+            .pending_integer_scale = 1,
+        };
+
+        wl_output_add_listener(wl_output, &output_listener, output);
+
+        if (session_lock) {
+            // Plugged in while locked. It gets drawn as soon as it's configured.
+            create_lock_surface(output);
+        }
+
+        return;
+    }
+
+    fprintf(stderr, "Too many outputs, ignoring one\n");
+    wl_output_destroy(wl_output);
+}
+
+static void remove_output(lock_output_t *output)
+{
+    destroy_lock_surface(output);
+    wl_output_destroy(output->wl_output);
+    output->in_use = false;
+    output->wl_output = NULL;
+}
+
 // Keyboard listeners
 
 static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard, uint32_t format, int32_t fd, uint32_t size) 
@@ -270,28 +768,78 @@ static const struct wl_seat_listener seat_listener = {
     .name = seat_name,
 };
 
+// Shm listener
+static void shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
+{
+    for (unsigned i = 0; i < sizeof(kBufferFormats) / sizeof(kBufferFormats[0]); i++) {
+        if (kBufferFormats[i].wl_format == format) {
+            supported_buffer_formats |= (1 << i);
+        }
+    }
+}
+
+static const struct wl_shm_listener shm_listener = {
+    .format = shm_format,
+};
+
+// Picks the buffer format once wl_shm has listed what it supports. ARGB8888 and XRGB8888 are
+// always supported, anything else has to be asked for and advertised.
+static void choose_buffer_format(void)
+{
+    const char *requested = getenv(kPixelFormatEnvVar);
+    if (requested == NULL) {
+        return;
+    }
+
+    for (unsigned i = 0; i < sizeof(kBufferFormats) / sizeof(kBufferFormats[0]); i++) {
+        if (strcmp(kBufferFormats[i].name, requested) != 0) continue;
+
+        if (supported_buffer_formats & (1 << i)) {
+            buffer_format = &kBufferFormats[i];
+        } else {
+            fprintf(stderr, "Compositor does not support %s buffers, using %s\n", requested, buffer_format->name);
+        }
+
+        return;
+    }
+
+    fprintf(stderr, "Unknown pixel format \"%s\", using %s\n", requested, buffer_format->name);
+}
+
 // Registry listener
 static void registry_global(void *data, struct wl_registry *registry,
                           uint32_t id, const char *interface, uint32_t version)
 {
     if (strcmp(interface, wl_compositor_interface.name) == 0) {
         compositor = wl_registry_bind(registry, id, &wl_compositor_interface, 4);
+    } else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+        subcompositor = wl_registry_bind(registry, id, &wl_subcompositor_interface, 1);
+    } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+        viewporter = wl_registry_bind(registry, id, &wp_viewporter_interface, 1);
     } else if (strcmp(interface, wl_shm_interface.name) == 0) {
         shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
+        wl_shm_add_listener(shm, &shm_listener, NULL);
     } else if (strcmp(interface, ext_session_lock_manager_v1_interface.name) == 0) {
         session_lock_manager = wl_registry_bind(registry, id, &ext_session_lock_manager_v1_interface, 1);
     } else if (strcmp(interface, wl_seat_interface.name) == 0) {
         seat = wl_registry_bind(registry, id, &wl_seat_interface, 7);
     } else if (strcmp(interface, wl_output_interface.name) == 0) {
-        if (!output) { // TODO: need to check for preferred output, this just uses the first one. 
-            output = wl_registry_bind(registry, id, &wl_output_interface, 3);
-        }
+        add_output(id, wl_registry_bind(registry, id, &wl_output_interface, 3));
+    }
+#ifdef HAVE_FRACTIONAL_SCALE
+    else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
+        fractional_scale_manager = wl_registry_bind(registry, id, &wp_fractional_scale_manager_v1_interface, 1);
     }
+#endif
 }
 
 static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t id)
 {
-    // Handle removal of globals
+    for (unsigned i = 0; i < kMaxOutputs; i++) {
+        if (outputs[i].in_use && outputs[i].registry_name == id) {
+            remove_output(&outputs[i]);
+        }
+    }
 }
 
 static const struct wl_registry_listener registry_listener = {
@@ -316,30 +864,223 @@ static int create_shm_file(size_t size)
     return fd;
 }
 
-static struct wl_buffer* create_buffer(int width, int height)
+// Swapchain
+static void buffer_release(void *data, struct wl_buffer *wl_buffer)
 {
-    int stride = width * 4; // 4 bytes per pixel (ARGB)
-    shm_size = stride * height;
+    swapchain_buffer_t *buffer = (swapchain_buffer_t *)data;
+    buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+static void destroy_swapchain(lock_plane_t *plane)
+{
+    for (unsigned i = 0; i < kSwapchainLength; i++) {
+        swapchain_buffer_t *buffer = &plane->swapchain[i];
+        if (buffer->cairo_surface) cairo_surface_destroy(buffer->cairo_surface);
+        if (buffer->wl_buffer) wl_buffer_destroy(buffer->wl_buffer);
+        if (buffer->stale_region) cairo_region_destroy(buffer->stale_region);
+    }
+
+    memset(plane->swapchain, 0, sizeof(plane->swapchain));
+    plane->front_buffer = NULL;
+    plane->back_buffer = NULL;
+
+    if (plane->shm_data && plane->shm_size > 0) {
+        munmap(plane->shm_data, plane->shm_size);
+        plane->shm_data = NULL;
+        plane->shm_size = 0;
+    }
+}
+
+static bool create_swapchain(lock_plane_t *plane)
+{
+    // All buffers are carved out of a single pool
+    const int width = plane->rect.width;
+    const int height = plane->rect.height;
+    const int stride = cairo_format_stride_for_width(buffer_format->cairo_format, width);
+    const int buffer_size = stride * height;
+    const size_t shm_size = (size_t)buffer_size * kSwapchainLength;
     
     int fd = create_shm_file(shm_size);
     if (fd < 0) {
-        return NULL;
+        return false;
     }
     
-    shm_data = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // Fresh memfd pages read back as zero, i.e., black
+    void *shm_data = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
     if (shm_data == MAP_FAILED) {
         close(fd);
-        return NULL;
+        return false;
     }
+
+    plane->shm_data = shm_data;
+    plane->shm_size = shm_size;
     
-    // Cairo ARGB32 on little-endian is BGRA in memory.
+    // Cairo's formats match the little-endian wl_shm ones (ARGB32 is BGRA in memory).
     struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, shm_size);
-    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, WL_SHM_FORMAT_ARGB8888);
+    for (unsigned i = 0; i < kSwapchainLength; i++) {
+        swapchain_buffer_t *buffer = &plane->swapchain[i];
+        unsigned char *data = (unsigned char *)shm_data + (i * buffer_size);
+
+        buffer->wl_buffer = wl_shm_pool_create_buffer(pool, i * buffer_size, width, height, stride, buffer_format->wl_format);
+        wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+
+        buffer->cairo_surface = cairo_image_surface_create_for_data(data, buffer_format->cairo_format, width, height, stride);
+        buffer->stale_region = cairo_region_create();
+        buffer->busy = false;
+    }
     
     wl_shm_pool_destroy(pool);
     close(fd);
     
-    return buffer;
+    return true;
+}
+
+static swapchain_buffer_t* find_free_buffer(lock_plane_t *plane)
+{
+    for (unsigned i = 0; i < kSwapchainLength; i++) {
+        if (!plane->swapchain[i].busy) {
+            return &plane->swapchain[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Brings `buffer` up to date with the front buffer by copying over everything
+// that was committed since it was last drawn to.
+static void copy_stale_region(lock_plane_t *plane, swapchain_buffer_t *buffer)
+{
+    swapchain_buffer_t *front_buffer = plane->front_buffer;
+    if (front_buffer != NULL && front_buffer != buffer) {
+        cairo_surface_flush(front_buffer->cairo_surface);
+        cairo_surface_flush(buffer->cairo_surface);
+
+        const unsigned char *src = cairo_image_surface_get_data(front_buffer->cairo_surface);
+        unsigned char *dst = cairo_image_surface_get_data(buffer->cairo_surface);
+        const int stride = cairo_image_surface_get_stride(buffer->cairo_surface);
+        const int bytes_per_pixel = buffer_format->bytes_per_pixel;
+
+        const int num_rects = cairo_region_num_rectangles(buffer->stale_region);
+        for (int i = 0; i < num_rects; i++) {
+            cairo_rectangle_int_t rect;
+            cairo_region_get_rectangle(buffer->stale_region, i, &rect);
+            for (int y = rect.y; y < rect.y + rect.height; y++) {
+                const size_t offset = ((size_t)y * stride) + ((size_t)rect.x * bytes_per_pixel);
+                memcpy(dst + offset, src + offset, (size_t)rect.width * bytes_per_pixel);
+            }
+        }
+
+        cairo_surface_mark_dirty(buffer->cairo_surface);
+    }
+
+    cairo_region_destroy(buffer->stale_region);
+    buffer->stale_region = cairo_region_create();
+}
+
+// Background
+static void background_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+    background_buffer_t *buffer = (background_buffer_t *)data;
+    buffer->busy = false;
+}
+
+static const struct wl_buffer_listener background_buffer_listener = {
+    .release = background_buffer_release,
+};
+
+static bool create_background_buffers(void)
+{
+    const size_t shm_size = sizeof(uint32_t) * kBackgroundBufferCount;
+    int fd = create_shm_file(shm_size);
+    if (fd < 0) {
+        return false;
+    }
+
+    void *shm_data = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm_data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    background_shm_data = shm_data;
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, shm_size);
+    for (unsigned i = 0; i < kBackgroundBufferCount; i++) {
+        background_buffer_t *buffer = &background_buffers[i];
+        const int offset = i * sizeof(uint32_t);
+        buffer->wl_buffer = wl_shm_pool_create_buffer(pool, offset, 1, 1, sizeof(uint32_t), WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(buffer->wl_buffer, &background_buffer_listener, buffer);
+        buffer->pixel = (uint32_t *)shm_data + i;
+        buffer->busy = false;
+    }
+
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    return true;
+}
+
+static void destroy_background_buffers(void)
+{
+    for (unsigned i = 0; i < kBackgroundBufferCount; i++) {
+        if (background_buffers[i].wl_buffer) wl_buffer_destroy(background_buffers[i].wl_buffer);
+    }
+
+    memset(background_buffers, 0, sizeof(background_buffers));
+
+    if (background_shm_data) {
+        munmap(background_shm_data, sizeof(uint32_t) * kBackgroundBufferCount);
+        background_shm_data = NULL;
+    }
+}
+
+// A buffer filled with `pixel`, or NULL if the compositor is holding on to all of them
+static background_buffer_t* get_background_buffer(uint32_t pixel)
+{
+    if (background_shm_data == NULL && !create_background_buffers()) {
+        return NULL;
+    }
+
+    // Whichever already has this color can be attached again, even while it's on screen
+    for (unsigned i = 0; i < kBackgroundBufferCount; i++) {
+        if (*background_buffers[i].pixel == pixel) {
+            return &background_buffers[i];
+        }
+    }
+
+    for (unsigned i = 0; i < kBackgroundBufferCount; i++) {
+        background_buffer_t *buffer = &background_buffers[i];
+        if (!buffer->busy) {
+            *buffer->pixel = pixel;
+            return buffer;
+        }
+    }
+
+    return NULL;
+}
+
+// Shows the current background color on the output's lock surface, if it's not already.
+// Goes out with the next commit.
+static void update_output_background(lock_output_t *output)
+{
+    if (!use_subsurfaces() || output->background_pixel == background_pixel) {
+        return;
+    }
+
+    background_buffer_t *buffer = get_background_buffer(background_pixel);
+    if (buffer == NULL) {
+        // Try again on the next commit
+        return;
+    }
+
+    wl_surface_attach(output->surface, buffer->wl_buffer, 0, 0);
+    wl_surface_damage_buffer(output->surface, 0, 0, 1, 1);
+    buffer->busy = true;
+    output->background_pixel = background_pixel;
 }
 
 static bool wayland_init(void)
@@ -359,13 +1100,17 @@ static bool wayland_init(void)
     // Set up seat listener if we found a seat
     if (seat) {
         wl_seat_add_listener(seat, &seat_listener, NULL);
-        wl_display_roundtrip(display);
     }
+
+    // Second roundtrip for the seat's capabilities and the formats wl_shm supports
+    wl_display_roundtrip(display);
     
     if (!compositor || !shm) {
         fprintf(stderr, "Failed to get required Wayland interfaces\n");
         return false;
     }
+
+    choose_buffer_format();
     
     if (!session_lock_manager) {
         fprintf(stderr, "Compositor does not support ext-session-lock-v1\n");
@@ -387,100 +1132,110 @@ static bool wayland_init(void)
 
 static cairo_surface_t* wayland_acquire_surface(void)
 {
-    if (!display || !compositor || !session_lock || !output) {
+    if (!display || !compositor || !session_lock) {
         return NULL;
     }
 
-    bool success = false;
-    cairo_surface_t *cairo_surface = NULL;
-    
-    do {
-        // Create Wayland surface
-        surface = wl_compositor_create_surface(compositor);
-        if (!surface) {
-            break; 
+    // Every output needs a lock surface, otherwise the compositor leaves it blank
+    bool have_outputs = false;
+    for (unsigned i = 0; i < kMaxOutputs; i++) {
+        if (outputs[i].in_use && outputs[i].lock_surface == NULL) {
+            create_lock_surface(&outputs[i]);
         }
-    
-        // Create lock surface for the output
-        lock_surface = ext_session_lock_v1_get_lock_surface(session_lock, surface, output);
-        if (!lock_surface) {
-            break;
-        }
-    
-        ext_session_lock_surface_v1_add_listener(lock_surface, &lock_surface_listener, NULL);
 
-        // Wait for configure event to get the correct size
-        wl_display_roundtrip(display);
-    
-        if (!surface_configured) {
-            fprintf(stderr, "Surface not configured after roundtrip\n");
-            break;
-        }
-    
-        // Create shared memory buffer  
-        buffer = create_buffer(surface_width, surface_height);
-        if (!buffer) {
-            break;
+        have_outputs |= outputs[i].in_use;
+    }
+
+    if (!have_outputs) {
+        fprintf(stderr, "No outputs to lock\n");
+        return NULL;
+    }
+
+    // Wait for configure events to get the correct sizes
+    wl_display_roundtrip(display);
+
+    // Attach a buffer to each surface, which is required before the first commit: the
+    // background, or a blank one if everything goes on the lock surface. Outputs of
+    // the same size share one. Planes show up once there's something drawn in them.
+    for (unsigned i = 0; i < kMaxOutputs; i++) {
+        lock_output_t *output = &outputs[i];
+        if (!output->in_use || !output->configured || output->view < 0) {
+            if (output->in_use) fprintf(stderr, "Output not configured after roundtrip\n");
+            continue;
         }
-    
-        // Clear buffer to transparent black
-        memset(shm_data, 0x00, shm_size);
-    
-        // Attach buffer to surface (required before first commit)
-        wl_surface_attach(surface, buffer, 0, 0);
-        wl_surface_damage_buffer(surface, 0, 0, INT32_MAX, INT32_MAX);
-        wl_surface_commit(surface);
-    
-        // Now wait for the compositor to acknowledge the session lock
-        wl_display_flush(display);
 
-        while (!session_is_locked && session_lock) {
-            if (wl_display_dispatch(display) < 0) {
-                fprintf(stderr, "Failed to dispatch Wayland events while waiting for session lock\n");
-                break;
+        lock_view_t *view = &views[output->view];
+        apply_output_scale(output);
+        update_output_planes(output, view);
+
+        if (use_subsurfaces()) {
+            update_output_background(output);
+        } else {
+            lock_plane_t *plane = &view->planes[0];
+            if (plane->front_buffer == NULL) {
+                if (!create_swapchain(plane)) {
+                    fprintf(stderr, "Failed to create buffers for output\n");
+                    continue;
+                }
+
+                plane->front_buffer = &plane->swapchain[0];
+                plane->front_buffer->busy = true;
             }
-        }
 
-        if (!session_is_locked) {
-            break;
+            wl_surface_attach(output->surface, plane->front_buffer->wl_buffer, 0, 0);
+            wl_surface_damage_buffer(output->surface, 0, 0, INT32_MAX, INT32_MAX);
         }
-    
-        // Create Cairo surface from shared memory 
-        cairo_surface = cairo_image_surface_create_for_data(
-            (unsigned char *)shm_data,
-            CAIRO_FORMAT_ARGB32,
-            surface_width,
-            surface_height,
-            surface_width * 4
-        );
-    
-        if (!cairo_surface) {
-            fprintf(stderr, "Failed to create Cairo surface\n");
+
+        // Planes get their first buffers attached along with the first frame
+        wl_surface_commit(output->surface);
+        output->needs_full_damage = use_subsurfaces();
+    }
+
+    // Now wait for the compositor to acknowledge the session lock
+    wl_display_flush(display);
+
+    while (!session_is_locked && session_lock) {
+        if (wl_display_dispatch(display) < 0) {
+            fprintf(stderr, "Failed to dispatch Wayland events while waiting for session lock\n");
             break;
         }
-    
-        // Store reference for flushing during commits
-        current_cairo_surface = cairo_surface;
-        success = true;
-    } while (0);
-
-    if (!success) {
-        if (surface != NULL) wl_surface_destroy(surface);
-        if (lock_surface != NULL) ext_session_lock_surface_v1_destroy(lock_surface);
-        if (buffer != NULL) wl_buffer_destroy(buffer);
+    }
 
+    if (!session_is_locked) {
+        wayland_destroy_surface(NULL);
         return NULL;
     } 
     
-    return cairo_surface;
+    // Surfaces are owned by the swapchains
+    display_plane_t planes[kMaxPlanes];
+    if (wayland_begin_frame(0, planes) == 0) {
+        return NULL;
+    }
+
+    return planes[0].surface;
+}
+
+static unsigned int wayland_get_num_views(void)
+{
+    unsigned int num_views = 0;
+    for (unsigned i = 0; i < kMaxViews; i++) {
+        if (views[i].in_use) {
+            num_views = i + 1;
+        }
+    }
+
+    return num_views;
 }
 
-static void wayland_get_display_bounds(unsigned int monitor_num, display_bounds_t *bounds)
+static void wayland_get_view_bounds(unsigned int view, display_bounds_t *bounds)
 {
     bounds->x = 0;
     bounds->y = 0;
-    bounds->width = surface_width;
-    bounds->height = surface_height;
+    bounds->width = views[view].logical_width;
+    bounds->height = views[view].logical_height;
+    bounds->scale = views[view].scale;
+    bounds->pixel_width = views[view].width;
+    bounds->pixel_height = views[view].height;
 }
 
 static void wayland_poll_events(void *state)
@@ -513,48 +1268,213 @@ static void wayland_poll_events(void *state)
     wl_display_flush(display);
 }
 
+// Frame callback listener
+static void frame_callback_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+    lock_view_t *view = (lock_view_t *)data;
+    wl_callback_destroy(callback);
+    if (callback == view->frame_callback) {
+        view->frame_callback = NULL;
+    }
+}
 
-static void wayland_commit_surface(void)
+static const struct wl_callback_listener frame_callback_listener = {
+    .done = frame_callback_done,
+};
+
+static int wayland_get_poll_fds(struct pollfd *fds, int max_fds)
 {
-    if (!surface || !buffer || !surface_configured) {
-        return;
+    if (!display || max_fds < 1) {
+        return 0;
     }
-    
-    wl_surface_attach(surface, buffer, 0, 0);
-	wl_surface_damage_buffer(surface, 0, 0, INT32_MAX, INT32_MAX);
-	wl_surface_commit(surface);
+
+    fds[0] = (struct pollfd) { .fd = wl_display_get_fd(display), .events = POLLIN };
+    return 1;
 }
 
-static void wayland_destroy_surface(cairo_surface_t *cairo_surface)
+static anim_time_interval_t wayland_next_frame_time(unsigned int view_idx)
 {
-    if (cairo_surface) {
-        cairo_surface_destroy(cairo_surface);
-        current_cairo_surface = NULL;
+    lock_view_t *view = &views[view_idx];
+    if (!view->in_use) {
+        return ANIM_TIME_NEVER;
     }
-    
-    if (shm_data && shm_size > 0) {
-        munmap(shm_data, shm_size);
-        shm_data = NULL;
-        shm_size = 0;
+
+    for (unsigned i = 0; i < view->num_planes; i++) {
+        lock_plane_t *plane = &view->planes[i];
+        const bool has_buffers = (plane->shm_data != NULL);
+        if (has_buffers && plane->back_buffer == NULL && find_free_buffer(plane) == NULL) {
+            // Nowhere to draw yet. A buffer release wakes the runloop via the display fd.
+            return ANIM_TIME_NEVER;
+        }
     }
-    
-    if (buffer) {
-        wl_buffer_destroy(buffer);
-        buffer = NULL;
+
+    if (view->frame_callback == NULL) {
+        // Compositor is ready for a new frame
+        return 0.0;
     }
-    
-    if (lock_surface) {
-        ext_session_lock_surface_v1_destroy(lock_surface);
-        lock_surface = NULL;
+
+    // Otherwise the done event wakes the runloop via the display fd.
+    return view->last_commit_time + kFrameCallbackTimeout;
+}
+
+static unsigned int wayland_begin_frame(unsigned int view_idx, display_plane_t *planes)
+{
+    lock_view_t *view = &views[view_idx];
+    if (!view->in_use) {
+        return 0;
     }
-    
-    if (surface) {
-        wl_surface_destroy(surface);
-        surface = NULL;
+
+    // Every plane needs somewhere to draw before any of them can
+    for (unsigned i = 0; i < view->num_planes; i++) {
+        lock_plane_t *plane = &view->planes[i];
+        if (plane->shm_data == NULL && !create_swapchain(plane)) {
+            fprintf(stderr, "Failed to allocate buffers for output\n");
+            return 0;
+        }
+
+        if (plane->back_buffer == NULL && find_free_buffer(plane) == NULL) {
+            // Compositor is still holding on to all of them
+            return 0;
+        }
+    }
+
+    for (unsigned i = 0; i < view->num_planes; i++) {
+        lock_plane_t *plane = &view->planes[i];
+        if (plane->back_buffer == NULL) {
+            plane->back_buffer = find_free_buffer(plane);
+            copy_stale_region(plane, plane->back_buffer);
+        }
+
+        planes[i] = (display_plane_t) {
+            .surface = plane->back_buffer->cairo_surface,
+            .rect = plane->rect,
+        };
+    }
+
+    return view->num_planes;
+}
+
+static void wayland_commit_surface(unsigned int view_idx, const cairo_region_t *damage)
+{
+    lock_view_t *view = &views[view_idx];
+    if (!view->in_use) {
+        return;
     }
     
-    // Reset state
-    surface_configured = false;
+    if (view->frame_callback) {
+        // Timed out waiting for the last one; it gets destroyed if it ever arrives.
+        view->frame_callback = NULL;
+    }
+
+    // Split the damage up between the planes. Planes that weren't drawn to keep their
+    // back buffer for the next frame.
+    cairo_region_t *plane_damage[kMaxPlanes] = { NULL };
+    for (unsigned p = 0; p < view->num_planes; p++) {
+        lock_plane_t *plane = &view->planes[p];
+        if (plane->back_buffer == NULL) {
+            continue;
+        }
+
+        cairo_region_t *region = cairo_region_copy(damage);
+        cairo_region_intersect_rectangle(region, &plane->rect);
+        cairo_region_translate(region, -plane->rect.x, -plane->rect.y);
+        if (cairo_region_is_empty(region)) {
+            cairo_region_destroy(region);
+            continue;
+        }
+
+        // The other buffers now lag behind by whatever we drew this frame
+        for (unsigned i = 0; i < kSwapchainLength; i++) {
+            if (&plane->swapchain[i] != plane->back_buffer) {
+                cairo_region_union(plane->swapchain[i].stale_region, region);
+            }
+        }
+
+        plane_damage[p] = region;
+    }
+
+    // Show the same buffers on every output in this view
+    for (unsigned i = 0; i < kMaxOutputs; i++) {
+        lock_output_t *output = &outputs[i];
+        if (!output->in_use || !output->configured || output->view != (int)view_idx) {
+            continue;
+        }
+
+        if (view->frame_callback == NULL) {
+            // Ask to be told when the compositor wants the next frame (one output paces the view)
+            view->frame_callback = wl_surface_frame(output->surface);
+            wl_callback_add_listener(view->frame_callback, &frame_callback_listener, view);
+        }
+
+        if (output->needs_full_damage) {
+            // Joined this view since the last commit, possibly at a different scale
+            apply_output_scale(output);
+            update_output_planes(output, view);
+        }
+
+        for (unsigned p = 0; p < view->num_planes; p++) {
+            lock_plane_t *plane = &view->planes[p];
+            struct wl_surface *surface = output_plane_surface(output, p);
+            if (output->needs_full_damage) {
+                swapchain_buffer_t *buffer = plane_damage[p] ? plane->back_buffer : plane->front_buffer;
+                if (buffer == NULL) {
+                    continue;
+                }
+
+                wl_surface_attach(surface, buffer->wl_buffer, 0, 0);
+                wl_surface_damage_buffer(surface, 0, 0, INT32_MAX, INT32_MAX);
+            } else if (plane_damage[p]) {
+                wl_surface_attach(surface, plane->back_buffer->wl_buffer, 0, 0);
+
+                const int num_rects = cairo_region_num_rectangles(plane_damage[p]);
+                for (int r = 0; r < num_rects; r++) {
+                    cairo_rectangle_int_t rect;
+                    cairo_region_get_rectangle(plane_damage[p], r, &rect);
+                    wl_surface_damage_buffer(surface, rect.x, rect.y, rect.width, rect.height);
+                }
+            } else {
+                continue;
+            }
+
+            // Subsurfaces are synchronized, so this only takes effect along with the lock surface
+            if (surface != output->surface) {
+                wl_surface_commit(surface);
+            }
+        }
+
+        update_output_background(output);
+        wl_surface_commit(output->surface);
+        output->needs_full_damage = false;
+    }
+
+    for (unsigned p = 0; p < view->num_planes; p++) {
+        lock_plane_t *plane = &view->planes[p];
+        if (plane_damage[p]) {
+            plane->back_buffer->busy = true;
+            plane->front_buffer = plane->back_buffer;
+            plane->back_buffer = NULL;
+            cairo_region_destroy(plane_damage[p]);
+        }
+    }
+
+    view->last_commit_time = anim_now();
+}
+
+static void wayland_set_background_color(double r, double g, double b)
+{
+    // Shown on every output with its next commit. Without subsurfaces, the
+    // background only ever gets drawn into the planes.
+    background_pixel = fill_pixel_from_rgba(r, g, b, 1.0);
+}
+
+static void wayland_destroy_surface(cairo_surface_t *cairo_surface)
+{
+    // `cairo_surface` belongs to a swapchain, which goes away along with its view
+    for (unsigned i = 0; i < kMaxOutputs; i++) {
+        if (outputs[i].in_use) {
+            destroy_lock_surface(&outputs[i]);
+        }
+    }
 }
 
 static void wayland_unlock_session(void)
@@ -586,10 +1506,13 @@ static void wayland_cleanup(void)
         seat = NULL;
     }
     
-    if (output) {
-        wl_output_destroy(output);
-        output = NULL;
+    for (unsigned i = 0; i < kMaxOutputs; i++) {
+        if (outputs[i].in_use) {
+            remove_output(&outputs[i]);
+        }
     }
+
+    destroy_background_buffers();
     
     if (session_lock) {
         ext_session_lock_v1_destroy(session_lock);
@@ -600,6 +1523,23 @@ static void wayland_cleanup(void)
         ext_session_lock_manager_v1_destroy(session_lock_manager);
         session_lock_manager = NULL;
     }
+
+#ifdef HAVE_FRACTIONAL_SCALE
+    if (fractional_scale_manager) {
+        wp_fractional_scale_manager_v1_destroy(fractional_scale_manager);
+        fractional_scale_manager = NULL;
+    }
+#endif
+
+    if (viewporter) {
+        wp_viewporter_destroy(viewporter);
+        viewporter = NULL;
+    }
+
+    if (subcompositor) {
+        wl_subcompositor_destroy(subcompositor);
+        subcompositor = NULL;
+    }
     
     if (compositor) {
         wl_compositor_destroy(compositor);
@@ -636,12 +1576,20 @@ static cairo_surface_t* wayland_acquire_surface(void)
     return NULL;
 }
 
-static void wayland_get_display_bounds(unsigned int monitor_num, display_bounds_t *bounds)
+static unsigned int wayland_get_num_views(void)
+{
+    return 0;
+}
+
+static void wayland_get_view_bounds(unsigned int view, display_bounds_t *bounds)
 {
     bounds->x = 0;
     bounds->y = 0;
     bounds->width = 1920;
     bounds->height = 1080;
+    bounds->scale = 1.0;
+    bounds->pixel_width = 1920;
+    bounds->pixel_height = 1080;
 }
 
 static void wayland_poll_events(void *state)
@@ -649,40 +1597,62 @@ static void wayland_poll_events(void *state)
     // No-op
 }
 
-static void wayland_commit_surface(void)
+static int wayland_get_poll_fds(struct pollfd *fds, int max_fds)
 {
-    // No-op
+    return 0;
 }
 
-static void wayland_destroy_surface(cairo_surface_t *surface)
+static anim_time_interval_t wayland_next_frame_time(unsigned int view)
+{
+    return ANIM_TIME_NEVER;
+}
+
+static unsigned int wayland_begin_frame(unsigned int view, display_plane_t *planes)
+{
+    return 0;
+}
+
+static void wayland_commit_surface(unsigned int view, const cairo_region_t *damage)
 {
     // No-op
 }
 
-static void wayland_cleanup(void)
+static void wayland_set_background_color(double r, double g, double b)
 {
     // No-op
 }
 
-#endif // HAVE_WAYLAND
+static void wayland_unlock_session(void)
+{
+    // No-op
+}
 
+static void wayland_destroy_surface(cairo_surface_t *surface)
+{
+    // No-op
+}
 
-static void wayland_await_frame(void)
+static void wayland_cleanup(void)
 {
-    // Wayland protocol is "don't call us, we call you" (commit frame). 
-    // So do nothing here. 
+    // No-op
 }
 
+#endif // HAVE_WAYLAND
+
 
 // Wayland backend interface
 const display_server_interface_t wayland_interface = {
     .init = wayland_init,
     .acquire_surface = wayland_acquire_surface,
-    .get_display_bounds = wayland_get_display_bounds,
+    .get_num_views = wayland_get_num_views,
+    .get_view_bounds = wayland_get_view_bounds,
     .poll_events = wayland_poll_events,
+    .get_poll_fds = wayland_get_poll_fds,
     .commit_surface = wayland_commit_surface,
+    .set_background_color = wayland_set_background_color,
     .unlock_session = wayland_unlock_session,
     .destroy_surface = wayland_destroy_surface,
-    .await_frame = wayland_await_frame,
+    .next_frame_time = wayland_next_frame_time,
+    .begin_frame = wayland_begin_frame,
     .cleanup = wayland_cleanup
 };
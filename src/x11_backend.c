@@ -11,15 +11,39 @@
 #include "animation.h"
 
 #include <X11/Xlib.h>
+#include <X11/Xresource.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/Xrandr.h> 
 
+#ifdef HAVE_XPRESENT
+#include <X11/extensions/Xpresent.h>
+#endif
+
+#ifdef HAVE_XSHM
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
+
 #include <cairo-xlib.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/param.h>
 #include <unistd.h>
 #include <string.h>
 
 static const int kXSecureLockCharFD = 0;
+static const int kDefaultFramesPerSecond = 60; // Used if XRandR can't tell us the monitor's refresh rate
+static const double kBaseDPI = 96.0;           // Xft.dpi at a scale of 1
+static const anim_time_interval_t kPresentNotifyTimeout = 0.25;
+static const anim_time_interval_t kShmCompletionTimeout = 0.25;
+
+// "shm" (default, if the server supports it) draws into client memory and uploads damaged
+// rects with XShmPutImage. "xlib" renders through the server with Xlib/XRender.
+static const char *kSurfaceTypeEnvVar = "BUZZLOCKER_X11_SURFACE";
+
+#define kMaxOutputs 16
 
 typedef struct {
     int x;
@@ -28,13 +52,156 @@ typedef struct {
     int height;
 } x11_display_bounds_t;
 
+// One window per monitor. The server fills it with the background pixel; the parts of the
+// canvas with anything else on them are shown in child windows, one per plane.
+typedef struct {
+    Window                  window;
+    x11_display_bounds_t    bounds;
+    anim_time_interval_t    frame_interval;
+    int                     view;
+
+    Window                  plane_windows[kMaxPlanes];
+    unsigned int            num_planes;
+    unsigned long           background_pixel;
+    bool                    has_background;
+} x11_output_t;
+
+// Part of a view's canvas, drawn offscreen and copied into the plane's child windows
+typedef struct {
+    cairo_rectangle_int_t   rect;           // In pixels of the whole canvas
+    cairo_surface_t        *surface;
+
+    // Xlib path: drawn into this pixmap on the server
+    Pixmap                  pixmap;
+
+#ifdef HAVE_XSHM
+    // MIT-SHM path: drawn into this image in shared memory
+    XShmSegmentInfo         shm_info;
+    XImage                 *shm_image;
+#endif
+} x11_plane_t;
+
+// Frames are drawn once per view, and then copied into every window of that size.
+typedef struct {
+    bool                    in_use;
+    int                     width;
+    int                     height;
+
+    x11_plane_t             planes[kMaxPlanes];
+    unsigned int            num_planes;
+
+#ifdef HAVE_XSHM
+    // Set from XShmPutImage until the server is done reading the segments
+    bool                    shm_put_pending;
+#endif
+
+    // Frame pacing, against the monitor of the view's first window
+    Window                  pacing_window;
+    anim_time_interval_t    frame_interval;
+    anim_time_interval_t    last_commit_time;
+#ifdef HAVE_XPRESENT
+    uint32_t                present_serial;
+    bool                    present_notify_pending;
+#endif
+} x11_view_t;
 
-static Window __window = { 0 };
 static Display *__display = NULL;
+static GC __gc = NULL;
+static unsigned long __background_pixel = 0;
+
+// Device pixels per logical pixel. X has no per-monitor scale, so this comes from Xft.dpi
+// (which is what toolkits go by too).
+static double __scale = 1.0;
+
+static x11_output_t __outputs[kMaxOutputs] = { 0 };
+static unsigned __num_outputs = 0;
+static x11_view_t __views[kMaxViews] = { 0 };
 
-static void x11_get_display_bounds_w(Window window, unsigned int monitor_num, x11_display_bounds_t *out_bounds);
+// Set once xsecurelock closes its end (or stdin is at EOF), so we stop polling it
+static bool __xsl_fd_closed = false;
 
-static void get_window_from_environment_or_make_one(Window *window, Display *display, int *out_width, int *out_height)
+#ifdef HAVE_XPRESENT
+static bool __present_available = false;
+static int __present_opcode = 0;
+static uint32_t __present_serial = 0;
+#endif
+
+#ifdef HAVE_XSHM
+static int __shm_completion_event = 0;
+#endif
+
+// Returns the frame interval of the mode the given monitor is currently driven at
+static anim_time_interval_t x11_get_frame_interval_w(Window window, unsigned int monitor_num)
+{
+    anim_time_interval_t interval = (1.0 / kDefaultFramesPerSecond);
+
+    int num_monitors = 0;
+    XRRMonitorInfo *monitor_infos = XRRGetMonitors(__display, window, True, &num_monitors);
+    XRRScreenResources *resources = XRRGetScreenResourcesCurrent(__display, window);
+    if (monitor_infos != NULL && resources != NULL && num_monitors > 0) {
+        XRRMonitorInfo *monitor = &monitor_infos[(monitor_num < (unsigned int)num_monitors) ? monitor_num : 0];
+
+        XRROutputInfo *output_info = NULL;
+        if (monitor->noutput > 0) {
+            output_info = XRRGetOutputInfo(__display, resources, monitor->outputs[0]);
+        }
+
+        XRRCrtcInfo *crtc_info = NULL;
+        if (output_info != NULL && output_info->crtc != None) {
+            crtc_info = XRRGetCrtcInfo(__display, resources, output_info->crtc);
+        }
+
+        for (int i = 0; crtc_info != NULL && i < resources->nmode; i++) {
+            const XRRModeInfo *mode = &resources->modes[i];
+            if (mode->id != crtc_info->mode) continue;
+
+            double v_total = mode->vTotal;
+            if (mode->modeFlags & RR_DoubleScan) v_total *= 2.0;
+            if (mode->modeFlags & RR_Interlace)  v_total /= 2.0;
+
+            if (mode->dotClock > 0 && mode->hTotal > 0 && v_total > 0) {
+                interval = (mode->hTotal * v_total) / mode->dotClock;
+            }
+
+            break;
+        }
+
+        if (crtc_info != NULL) XRRFreeCrtcInfo(crtc_info);
+        if (output_info != NULL) XRRFreeOutputInfo(output_info);
+    }
+
+    if (resources != NULL) XRRFreeScreenResources(resources);
+    if (monitor_infos != NULL) XRRFreeMonitors(monitor_infos);
+
+    return interval;
+}
+
+static double x11_get_scale(void)
+{
+    double scale = 1.0;
+
+    const char *resource_string = XResourceManagerString(__display);
+    if (resource_string == NULL) {
+        return scale;
+    }
+
+    XrmInitialize();
+    XrmDatabase database = XrmGetStringDatabase(resource_string);
+
+    char *type = NULL;
+    XrmValue value = { 0 };
+    if (XrmGetResource(database, "Xft.dpi", "Xft.Dpi", &type, &value) && value.addr != NULL) {
+        const double dpi = strtod(value.addr, NULL);
+        if (dpi > 0.0) {
+            scale = dpi / kBaseDPI;
+        }
+    }
+
+    XrmDestroyDatabase(database);
+    return scale;
+}
+
+static void create_windows_from_environment(void)
 {
     Window parent_window;
 
@@ -48,57 +215,289 @@ static void get_window_from_environment_or_make_one(Window *window, Display *dis
         // Get parent window
         unsigned int unused_num_children = 0;
         Window unused_root, *unused_children = NULL;
-        XQueryTree(display, root_window, &unused_root, &parent_window, &unused_children, &unused_num_children);
+        XQueryTree(__display, root_window, &unused_root, &parent_window, &unused_children, &unused_num_children);
     } else {
         parent_window = root_window;
     }
 
-    // Figure out which monitor this is supposed to go on
-    const unsigned int preferred_monitor = get_preferred_monitor_num();
-    x11_display_bounds_t bounds;
-    x11_get_display_bounds_w(root_window, preferred_monitor, &bounds);
-
-    *window = XCreateSimpleWindow(
-            display,        // display
-            parent_window,  // parent window
-            bounds.x,       // x 
-            bounds.y,       // y
-            bounds.width,   // width
-            bounds.height,  // height
-            0,              // border_width
-            0,              // border
-            0               // background
+    int num_monitors = 0;
+    XRRMonitorInfo *monitor_infos = XRRGetMonitors(__display, root_window, True, &num_monitors);
+    if (num_monitors == 0) {
+        fprintf(stderr, "FATAL: Couldn't get monitor info from XRandR!\n");
+        exit(1);
+    }
+
+    // Every monitor gets locked, unless we were asked to stick to one
+    int only_monitor = -1;
+    if (has_preferred_monitor()) {
+        only_monitor = get_preferred_monitor_num();
+        if (only_monitor >= num_monitors) {
+            fprintf(stderr, "WARNING: Specified monitor number is greater than the number of connected monitors!\n");
+            only_monitor = 0;
+        }
+    }
+
+    for (int i = 0; i < num_monitors && __num_outputs < kMaxOutputs; i++) {
+        if (only_monitor >= 0 && i != only_monitor) continue;
+
+        XRRMonitorInfo *monitor = &monitor_infos[i];
+        x11_output_t *output = &__outputs[__num_outputs++];
+        output->bounds = (x11_display_bounds_t) {
+            .x = monitor->x,
+            .y = monitor->y,
+            .width = monitor->width,
+            .height = monitor->height,
+        };
+        output->frame_interval = x11_get_frame_interval_w(root_window, i);
+        output->view = -1;
+
+        output->window = XCreateSimpleWindow(
+                __display,          // display
+                parent_window,      // parent window
+                monitor->x,         // x 
+                monitor->y,         // y
+                monitor->width,     // width
+                monitor->height,    // height
+                0,                  // border_width
+                0,                  // border
+                0                   // background
+        );
+    }
+
+    XRRFreeMonitors(monitor_infos);
+}
+
+static void assign_views(void)
+{
+    for (unsigned i = 0; i < __num_outputs; i++) {
+        x11_output_t *output = &__outputs[i];
+        for (int v = 0; v < kMaxViews && output->view < 0; v++) {
+            x11_view_t *view = &__views[v];
+            if (!view->in_use) {
+                *view = (x11_view_t) {
+                    .in_use = true,
+                    .width = output->bounds.width,
+                    .height = output->bounds.height,
+                    .pacing_window = output->window,
+                    .frame_interval = output->frame_interval,
+                };
+            }
+
+            if (view->width == output->bounds.width && view->height == output->bounds.height) {
+                output->view = v;
+            }
+        }
+
+        if (output->view < 0) {
+            fprintf(stderr, "Too many different monitor sizes, monitor will stay blank\n");
+        }
+    }
+}
+
+static void x11_setup_frame_pacing(void)
+{
+    for (unsigned v = 0; v < kMaxViews; v++) {
+        if (__views[v].in_use) {
+            fprintf(stderr, "Pacing frames for %dx%d at %.2f Hz\n",
+                    __views[v].width, __views[v].height, 1.0 / __views[v].frame_interval);
+        }
+    }
+
+#ifdef HAVE_XPRESENT
+    // With Present, the server tells us when the CRTC a window is on reaches its next vblank.
+    int event_base, error_base;
+    if (XPresentQueryExtension(__display, &__present_opcode, &event_base, &error_base)) {
+        for (unsigned v = 0; v < kMaxViews; v++) {
+            if (__views[v].in_use) {
+                XPresentSelectInput(__display, __views[v].pacing_window, PresentCompleteNotifyMask);
+            }
+        }
+
+        __present_available = true;
+    }
+#endif
+}
+
+#ifdef HAVE_XSHM
+static bool __shm_attach_failed = false;
+
+static int x11_shm_attach_error_handler(Display *display, XErrorEvent *error)
+{
+    // e.g., connected to a remote server, which can't map our segment
+    __shm_attach_failed = true;
+    return 0;
+}
+
+static void x11_shm_destroy(x11_plane_t *plane)
+{
+    if (plane->shm_image != NULL) {
+        if (plane->shm_info.shmaddr != NULL && !__shm_attach_failed) {
+            XShmDetach(__display, &plane->shm_info);
+        }
+
+        plane->shm_image->data = NULL; // Belongs to the segment
+        XDestroyImage(plane->shm_image);
+        plane->shm_image = NULL;
+    }
+
+    if (plane->shm_info.shmaddr != NULL) {
+        shmdt(plane->shm_info.shmaddr);
+        plane->shm_info.shmaddr = NULL;
+    }
+}
+
+static cairo_surface_t* x11_shm_create_surface(x11_plane_t *plane, Visual *visual, int depth)
+{
+    // Cairo's image formats are 32bpp native-endian xRGB
+    if ((depth != 24 && depth != 32) || visual->red_mask != 0xff0000 || visual->green_mask != 0x00ff00 || visual->blue_mask != 0x0000ff) {
+        fprintf(stderr, "Window visual doesn't match cairo's pixel format, rendering through Xlib\n");
+        return NULL;
+    }
+
+    plane->shm_image = XShmCreateImage(__display, visual, depth, ZPixmap, NULL, &plane->shm_info, plane->rect.width, plane->rect.height);
+    if (plane->shm_image == NULL || plane->shm_image->bits_per_pixel != 32) {
+        x11_shm_destroy(plane);
+        return NULL;
+    }
+
+    plane->shm_info.shmid = shmget(IPC_PRIVATE, plane->shm_image->bytes_per_line * plane->shm_image->height, IPC_CREAT | 0600);
+    if (plane->shm_info.shmid < 0) {
+        x11_shm_destroy(plane);
+        return NULL;
+    }
+
+    plane->shm_info.shmaddr = plane->shm_image->data = shmat(plane->shm_info.shmid, NULL, 0);
+    if (plane->shm_info.shmaddr == (char *)-1) {
+        plane->shm_info.shmaddr = NULL;
+        shmctl(plane->shm_info.shmid, IPC_RMID, NULL);
+        x11_shm_destroy(plane);
+        return NULL;
+    }
+    plane->shm_info.readOnly = False;
+
+    // Attach errors arrive asynchronously, so sync while our handler is installed.
+    __shm_attach_failed = false;
+    XErrorHandler previous_handler = XSetErrorHandler(x11_shm_attach_error_handler);
+    XShmAttach(__display, &plane->shm_info);
+    XSync(__display, False);
+    XSetErrorHandler(previous_handler);
+
+    // Segment goes away as soon as both sides have detached (including if we crash)
+    shmctl(plane->shm_info.shmid, IPC_RMID, NULL);
+
+    if (__shm_attach_failed) {
+        fprintf(stderr, "Couldn't attach MIT-SHM segment, rendering through Xlib\n");
+        x11_shm_destroy(plane);
+        __shm_attach_failed = false;
+        return NULL;
+    }
+
+    return cairo_image_surface_create_for_data(
+            (unsigned char *)plane->shm_image->data,
+            (depth == 32) ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+            plane->rect.width,
+            plane->rect.height,
+            plane->shm_image->bytes_per_line
     );
+}
+#endif
+
+static void x11_layout_view_planes(x11_view_t *view)
+{
+    const int logical_width = lround(view->width / __scale);
+    const int logical_height = lround(view->height / __scale);
+
+    cairo_rectangle_int_t logical_rects[kMaxPlanes];
+    unsigned int num_planes = get_content_rects(logical_width, logical_height, logical_rects, kMaxPlanes);
+    if (num_planes == 0) {
+        logical_rects[0] = (cairo_rectangle_int_t) { 0, 0, logical_width, logical_height };
+        num_planes = 1;
+    }
+
+    // Rounding each edge (rather than the size) keeps neighboring planes from overlapping
+    for (unsigned i = 0; i < num_planes; i++) {
+        const cairo_rectangle_int_t logical = logical_rects[i];
+        const int x1 = MIN(view->width, (int)lround(logical.x * __scale));
+        const int y1 = MIN(view->height, (int)lround(logical.y * __scale));
+        const int x2 = MIN(view->width, (int)lround((logical.x + logical.width) * __scale));
+        const int y2 = MIN(view->height, (int)lround((logical.y + logical.height) * __scale));
+
+        view->planes[i] = (x11_plane_t) {
+            .rect = { x1, y1, MAX(1, x2 - x1), MAX(1, y2 - y1) },
+        };
+    }
 
-    *out_width = bounds.width;
-    *out_height = bounds.height;
+    view->num_planes = num_planes;
 }
 
-void x11_get_display_bounds(unsigned int monitor_num, x11_display_bounds_t *out_bounds)
+static void x11_create_plane_windows(void)
 {
-    x11_get_display_bounds_w(__window, monitor_num, out_bounds);
+    for (unsigned i = 0; i < __num_outputs; i++) {
+        x11_output_t *output = &__outputs[i];
+        if (output->view < 0) continue;
+
+        // No background of their own, so nothing flashes before their contents get copied back in
+        const x11_view_t *view = &__views[output->view];
+        XSetWindowAttributes attributes = { .background_pixmap = None };
+        for (unsigned p = 0; p < view->num_planes; p++) {
+            const cairo_rectangle_int_t rect = view->planes[p].rect;
+            output->plane_windows[p] = XCreateWindow(__display, output->window, rect.x, rect.y, rect.width, rect.height,
+                                                     0, CopyFromParent, InputOutput, CopyFromParent, CWBackPixmap, &attributes);
+
+            // Input goes to the parent, which is the one selecting it
+            XSelectInput(__display, output->plane_windows[p], ExposureMask);
+        }
+
+        output->num_planes = view->num_planes;
+        XMapSubwindows(__display, output->window);
+    }
 }
 
-static void x11_get_display_bounds_w(Window window, unsigned int monitor_num, x11_display_bounds_t *out_bounds)
+static void x11_create_view_surfaces(void)
 {
-    int num_monitors = 0;
-    XRRMonitorInfo *monitor_infos = XRRGetMonitors(__display, window, True, &num_monitors);
-    if (num_monitors == 0) {
-        fprintf(stderr, "FATAL: Couldn't get monitor info from XRandR!\n");
-        exit(1);
+    int screen = DefaultScreen(__display);
+    Visual *visual = DefaultVisual(__display, screen);
+    const int depth = DefaultDepth(__display, screen);
+
+#ifdef HAVE_XSHM
+    const char *surface_type = getenv(kSurfaceTypeEnvVar);
+    bool use_shm = (surface_type == NULL || strcmp(surface_type, "xlib") != 0);
+    if (use_shm && !XShmQueryExtension(__display)) {
+        fprintf(stderr, "MIT-SHM not available, rendering through Xlib\n");
+        use_shm = false;
     }
 
-    unsigned int idx = monitor_num;
-    if (idx > num_monitors) {
-        fprintf(stderr, "WARNING: Specified monitor number is greater than the number of connected monitors!\n");
-        idx = 0;
+    if (use_shm) {
+        __shm_completion_event = XShmGetEventBase(__display) + ShmCompletion;
     }
+#endif
+
+    for (unsigned v = 0; v < kMaxViews; v++) {
+        x11_view_t *view = &__views[v];
+        if (!view->in_use) continue;
 
-    XRRMonitorInfo *monitor = &monitor_infos[idx];
-    out_bounds->x = monitor->x;
-    out_bounds->y = monitor->y;
-    out_bounds->width = monitor->width;
-    out_bounds->height = monitor->height;
+        x11_layout_view_planes(view);
+        for (unsigned p = 0; p < view->num_planes; p++) {
+            x11_plane_t *plane = &view->planes[p];
+
+#ifdef HAVE_XSHM
+            if (use_shm) {
+                plane->surface = x11_shm_create_surface(plane, visual, depth);
+            }
+#endif
+
+            if (plane->surface == NULL) {
+                plane->pixmap = XCreatePixmap(__display, view->pacing_window, plane->rect.width, plane->rect.height, depth);
+                plane->surface = cairo_xlib_surface_create(
+                        __display, 
+                        plane->pixmap,
+                        visual, 
+                        plane->rect.width, 
+                        plane->rect.height
+                );
+            }
+        }
+    }
 }
 
 cairo_surface_t* x11_helper_acquire_cairo_surface()
@@ -109,34 +508,52 @@ cairo_surface_t* x11_helper_acquire_cairo_surface()
         return NULL;
     }
 
-    // Create (or get) window
-    int width, height;
-    get_window_from_environment_or_make_one(&__window, __display, &width, &height);
+    // Create (or get) windows, and group them by size
+    create_windows_from_environment();
+    assign_views();
 
-    // Event mask
-    XSelectInput(__display, __window, ButtonPressMask | KeyPressMask | StructureNotifyMask);
+    for (unsigned i = 0; i < __num_outputs; i++) {
+        Window window = __outputs[i].window;
 
-    // Map window to display
-    XMapWindow(__display, __window);
+        // Event mask
+        XSelectInput(__display, window, ButtonPressMask | KeyPressMask | StructureNotifyMask | ExposureMask);
 
-    // Create cairo surface
-    int screen = DefaultScreen(__display);
-    Visual *visual = DefaultVisual(__display, screen);
+        // Map window to display
+        XMapWindow(__display, window);
+    }
 
-    cairo_surface_t *surface = cairo_xlib_surface_create(
-            __display, 
-            __window,
-            visual, 
-            width, 
-            height
-    );
+    x11_setup_frame_pacing();
+
+    __scale = x11_get_scale();
+    if (__scale != 1.0) {
+        fprintf(stderr, "Drawing at a scale of %.2f (from Xft.dpi)\n", __scale);
+    }
 
-    return surface;
+    __gc = XCreateGC(__display, __outputs[0].window, 0, NULL);
+    x11_create_view_surfaces();
+    x11_create_plane_windows();
+
+    return __views[0].planes[0].surface;
 }
 
 void x11_helper_destroy_surface(cairo_surface_t *surface)
 {
-    cairo_surface_destroy(surface);
+    // `surface` is one of the views' surfaces
+    for (unsigned v = 0; v < kMaxViews; v++) {
+        x11_view_t *view = &__views[v];
+        for (unsigned p = 0; p < view->num_planes; p++) {
+            x11_plane_t *plane = &view->planes[p];
+            if (plane->surface) cairo_surface_destroy(plane->surface);
+            if (plane->pixmap) XFreePixmap(__display, plane->pixmap);
+#ifdef HAVE_XSHM
+            x11_shm_destroy(plane);
+#endif
+        }
+
+        *view = (x11_view_t) { 0 };
+    }
+
+    if (__gc) XFreeGC(__display, __gc);
     XCloseDisplay(__display);
 }
 
@@ -155,15 +572,128 @@ static cairo_surface_t* x11_acquire_surface(void)
     return x11_helper_acquire_cairo_surface();
 }
 
-static void x11_backend_get_display_bounds(unsigned int monitor_num, display_bounds_t *bounds)
+static unsigned int x11_get_num_views(void)
 {
-    x11_display_bounds_t x11_bounds;
-    x11_get_display_bounds(monitor_num, &x11_bounds);
-    
-    bounds->x = x11_bounds.x;
-    bounds->y = x11_bounds.y;
-    bounds->width = x11_bounds.width;
-    bounds->height = x11_bounds.height;
+    unsigned int num_views = 0;
+    for (unsigned i = 0; i < kMaxViews; i++) {
+        if (__views[i].in_use) {
+            num_views = i + 1;
+        }
+    }
+
+    return num_views;
+}
+
+static void x11_get_view_bounds(unsigned int view, display_bounds_t *bounds)
+{
+    bounds->x = 0;
+    bounds->y = 0;
+    bounds->width = lround(__views[view].width / __scale);
+    bounds->height = lround(__views[view].height / __scale);
+    bounds->scale = __scale;
+    bounds->pixel_width = __views[view].width;
+    bounds->pixel_height = __views[view].height;
+}
+
+static unsigned int x11_begin_frame(unsigned int view_idx, display_plane_t *planes)
+{
+    x11_view_t *view = &__views[view_idx];
+    if (!view->in_use) {
+        return 0;
+    }
+
+#ifdef HAVE_XSHM
+    if (view->shm_put_pending) {
+        if (anim_now() < view->last_commit_time + kShmCompletionTimeout) {
+            // Server is still reading the last frame out of the segment
+            return 0;
+        }
+
+        // Never heard back; don't stall forever
+        view->shm_put_pending = false;
+    }
+#endif
+
+    for (unsigned p = 0; p < view->num_planes; p++) {
+        planes[p] = (display_plane_t) {
+            .surface = view->planes[p].surface,
+            .rect = view->planes[p].rect,
+        };
+    }
+
+    return view->num_planes;
+}
+
+// Scales a [0, 1] color component into a TrueColor visual's mask
+static unsigned long x11_color_component(double value, unsigned long mask)
+{
+    if (mask == 0) {
+        return 0;
+    }
+
+    const unsigned shift = __builtin_ctzl(mask);
+    const unsigned long max = mask >> shift;
+    return ((unsigned long)lround(fmin(fmax(value, 0.0), 1.0) * max) << shift) & mask;
+}
+
+static void x11_set_background_color(double r, double g, double b)
+{
+    // Goes out to each window with its view's next commit
+    Visual *visual = DefaultVisual(__display, DefaultScreen(__display));
+    __background_pixel = x11_color_component(r, visual->red_mask)
+                       | x11_color_component(g, visual->green_mask)
+                       | x11_color_component(b, visual->blue_mask);
+}
+
+// Copies (or uploads) a rect of the plane, in plane coordinates, into its window
+static void x11_put_plane_rect(x11_view_t *view, x11_plane_t *plane, Window window, cairo_rectangle_int_t rect)
+{
+#ifdef HAVE_XSHM
+    if (plane->shm_image != NULL) {
+        // Only the last request of the frame asks for a completion event, which tells us
+        // the server is done with the segments and we can draw into them again.
+        XShmPutImage(__display, window, __gc, plane->shm_image,
+                     rect.x, rect.y, rect.x, rect.y, rect.width, rect.height, False);
+        view->shm_put_pending = true;
+        return;
+    }
+#endif
+
+    XCopyArea(__display, plane->pixmap, window, __gc,
+              rect.x, rect.y, rect.width, rect.height, rect.x, rect.y);
+}
+
+// Asks to be told once the server is done reading whatever was put from the view's segments
+static void x11_finish_puts(x11_view_t *view)
+{
+#ifdef HAVE_XSHM
+    for (unsigned p = 0; view->shm_put_pending && p < view->num_planes; p++) {
+        if (view->planes[p].shm_image != NULL) {
+            // A zero-sized put, just to be told once all of the above have been read
+            XShmPutImage(__display, view->pacing_window, __gc, view->planes[p].shm_image, 0, 0, 0, 0, 0, 0, True);
+            break;
+        }
+    }
+#endif
+}
+
+// The server keeps the background and the planes' last frames around, so an expose only
+// needs them copied back in, never drawn again.
+static void x11_handle_expose(XExposeEvent *expose)
+{
+    for (unsigned i = 0; i < __num_outputs; i++) {
+        x11_output_t *output = &__outputs[i];
+        for (unsigned p = 0; p < output->num_planes; p++) {
+            if (output->plane_windows[p] != expose->window) continue;
+
+            x11_view_t *view = &__views[output->view];
+            const cairo_rectangle_int_t rect = { expose->x, expose->y, expose->width, expose->height };
+            x11_put_plane_rect(view, &view->planes[p], expose->window, rect);
+            x11_finish_puts(view);
+            XFlush(__display);
+            return;
+        }
+    }
 }
 
 static void post_keyboard_event(saver_state_t *state, event_type_t type, char letter)
@@ -209,13 +739,9 @@ static void handle_xsl_key_input(saver_state_t *state, const char c)
 {
     if (!state->input_allowed) return;
 
-    char *password_buf = state->password_buffer;
-    size_t pw_len = strlen(password_buf);
     switch (c) {
         case '\b':      // Backspace.
-            if (pw_len > 0) {
-                password_buf[pw_len - 1] = '\0';
-            }
+            post_keyboard_event(state, EVENT_KEYBOARD_BACKSPACE, 0);
             break;
         case '\177':  // Delete
             break;
@@ -238,6 +764,47 @@ static void handle_xsl_key_input(saver_state_t *state, const char c)
     }
 }
 
+static bool x11_handle_extension_event(XEvent *e)
+{
+#ifdef HAVE_XSHM
+    if (__shm_completion_event != 0 && e->type == __shm_completion_event) {
+        XShmCompletionEvent *completion = (XShmCompletionEvent *)e;
+        for (unsigned v = 0; v < kMaxViews; v++) {
+            for (unsigned p = 0; p < __views[v].num_planes; p++) {
+                const x11_plane_t *plane = &__views[v].planes[p];
+                if (plane->shm_image != NULL && plane->shm_info.shmseg == completion->shmseg) {
+                    __views[v].shm_put_pending = false;
+                }
+            }
+        }
+
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+static void x11_handle_generic_event(XEvent *e)
+{
+#ifdef HAVE_XPRESENT
+    XGenericEventCookie *cookie = &e->xcookie;
+    if (__present_available && cookie->extension == __present_opcode && XGetEventData(__display, cookie)) {
+        if (cookie->evtype == PresentCompleteNotify) {
+            XPresentCompleteNotifyEvent *complete = (XPresentCompleteNotifyEvent *)cookie->data;
+            for (unsigned v = 0; v < kMaxViews && complete->kind == PresentCompleteKindNotifyMSC; v++) {
+                if (__views[v].in_use && complete->serial_number == __views[v].present_serial) {
+                    // Reached the vblank we asked for, ready for the next frame.
+                    __views[v].present_notify_pending = false;
+                }
+            }
+        }
+
+        XFreeEventData(__display, cookie);
+    }
+#endif
+}
+
 static void x11_poll_events(void *state)
 {
     saver_state_t *saver_state = (saver_state_t *)state;
@@ -248,14 +815,18 @@ static void x11_poll_events(void *state)
 
     // Via xsecurelock, take this route
     char buf;
-    ssize_t read_res = read(kXSecureLockCharFD, &buf, 1);
-    if (read_res > 0) {
+    ssize_t read_res = 0;
+    while (!__xsl_fd_closed && (read_res = read(kXSecureLockCharFD, &buf, 1)) > 0) {
         handle_xsl_key_input(saver_state, buf);
         handled_key_event = true;
     }
 
+    if (read_res == 0) {
+        __xsl_fd_closed = true;
+    }
+
     // Handle X11 events
-    Display *display = cairo_xlib_surface_get_display(saver_state->surface);
+    Display *display = __display;
     for (;;) {
         if (block_for_next_event || XPending(display)) {
             XNextEvent(display, &e);
@@ -267,13 +838,21 @@ static void x11_poll_events(void *state)
             case ConfigureNotify:
                 post_keyboard_event(state, EVENT_SURFACE_SIZE_CHANGED, 0);
                 break;
+            case Expose:
+                x11_handle_expose(&e.xexpose);
+                break;
             case ButtonPress:
                 break;
+            case GenericEvent:
+                x11_handle_generic_event(&e);
+                break;
             case KeyPress:
                 handled_key_event = handle_key_event(saver_state, (XKeyEvent *)&e);
                 break;
             default:
-                fprintf(stderr, "Dropping unhandled X event.type = %d.\n", e.type);
+                if (!x11_handle_extension_event(&e)) {
+                    fprintf(stderr, "Dropping unhandled X event.type = %d.\n", e.type);
+                }
                 break;
         }
     }
@@ -284,9 +863,72 @@ static void x11_poll_events(void *state)
     }
 }
 
-static void x11_commit_surface(void)
+static int x11_get_poll_fds(struct pollfd *fds, int max_fds)
+{
+    int num_fds = 0;
+    if (num_fds < max_fds) {
+        fds[num_fds++] = (struct pollfd) { .fd = ConnectionNumber(__display), .events = POLLIN };
+    }
+
+    if (!__xsl_fd_closed && num_fds < max_fds) {
+        fds[num_fds++] = (struct pollfd) { .fd = kXSecureLockCharFD, .events = POLLIN };
+    }
+
+    return num_fds;
+}
+
+static void x11_commit_surface(unsigned int view_idx, const cairo_region_t *damage)
 {
-    // No-op for X11 - surface updates are immediate
+    x11_view_t *view = &__views[view_idx];
+    if (!view->in_use) {
+        return;
+    }
+
+    // Copy (or upload) what changed into every window showing this view
+    for (unsigned i = 0; i < __num_outputs; i++) {
+        x11_output_t *output = &__outputs[i];
+        if (output->view != (int)view_idx) continue;
+
+        // The server fills everything around the planes itself
+        if (!output->has_background || output->background_pixel != __background_pixel) {
+            XSetWindowBackground(__display, output->window, __background_pixel);
+            XClearWindow(__display, output->window);
+            output->background_pixel = __background_pixel;
+            output->has_background = true;
+        }
+
+        for (unsigned p = 0; p < view->num_planes && p < output->num_planes; p++) {
+            x11_plane_t *plane = &view->planes[p];
+            cairo_region_t *plane_damage = cairo_region_copy(damage);
+            cairo_region_intersect_rectangle(plane_damage, &plane->rect);
+            cairo_region_translate(plane_damage, -plane->rect.x, -plane->rect.y);
+
+            const int num_rects = cairo_region_num_rectangles(plane_damage);
+            for (int r = 0; r < num_rects; r++) {
+                cairo_rectangle_int_t rect;
+                cairo_region_get_rectangle(plane_damage, r, &rect);
+                x11_put_plane_rect(view, plane, output->plane_windows[p], rect);
+            }
+
+            cairo_region_destroy(plane_damage);
+        }
+    }
+
+    x11_finish_puts(view);
+
+#ifdef HAVE_XPRESENT
+    if (__present_available) {
+        // Ask to be notified at the next vblank (with a divisor of 1, a target
+        // MSC in the past means "the next one").
+        view->present_serial = ++__present_serial;
+        XPresentNotifyMSC(__display, view->pacing_window, view->present_serial, 0, 1, 0);
+        view->present_notify_pending = true;
+    }
+#endif
+
+    // Surface updates are immediate, just make sure they go out before we sleep.
+    XFlush(__display);
+    view->last_commit_time = anim_now();
 }
 
 static void x11_unlock_session(void)
@@ -300,23 +942,48 @@ static void x11_cleanup(void)
     // X11 cleanup is handled in x11_helper_destroy_surface
 }
 
-static void x11_await_frame(void)
+static anim_time_interval_t x11_next_frame_time(unsigned int view_idx)
 {
-    const int frames_per_sec = 60; // TODO: probably should get this from xrandr. 
-    const long sleep_nsec = (1.0 / frames_per_sec) * 1000000000;
-    struct timespec sleep_time = { 0, sleep_nsec };
-    nanosleep(&sleep_time, NULL);
+    x11_view_t *view = &__views[view_idx];
+    if (!view->in_use) {
+        return ANIM_TIME_NEVER;
+    }
+
+#ifdef HAVE_XSHM
+    if (view->shm_put_pending) {
+        // ShmCompletion wakes the runloop via the X connection
+        return view->last_commit_time + kShmCompletionTimeout;
+    }
+#endif
+
+#ifdef HAVE_XPRESENT
+    if (__present_available) {
+        if (!view->present_notify_pending) {
+            return 0.0;
+        }
+
+        // CompleteNotify wakes the runloop via the X connection. The timeout covers
+        // the CRTC being turned off, where vblanks stop arriving.
+        return view->last_commit_time + kPresentNotifyTimeout;
+    }
+#endif
+
+    return view->last_commit_time + view->frame_interval;
 }
 
 // X11 backend interface
 const display_server_interface_t x11_interface = {
     .init = x11_init,
     .acquire_surface = x11_acquire_surface,
-    .get_display_bounds = x11_backend_get_display_bounds,
+    .get_num_views = x11_get_num_views,
+    .get_view_bounds = x11_get_view_bounds,
     .poll_events = x11_poll_events,
+    .get_poll_fds = x11_get_poll_fds,
+    .begin_frame = x11_begin_frame,
     .commit_surface = x11_commit_surface,
+    .set_background_color = x11_set_background_color,
     .unlock_session = x11_unlock_session,
-    .await_frame = x11_await_frame,
+    .next_frame_time = x11_next_frame_time,
     .destroy_surface = x11_helper_destroy_surface,
     .cleanup = x11_cleanup
-};
\ No newline at end of file
+};